@@ -24,6 +24,8 @@
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
    (although some can be lost).
+   - loss, corruption, delay and bandwidth can be changed during the run
+   by a channel schedule (see readschedule()), including full blackouts.
 
    Modifications (6/6/2008 - CLP): 
    - removed bidirectional GBN code and other code not used by prac. 
@@ -34,57 +36,226 @@
    - fixed C style to adhere to current programming style
 
    ********************************************************************* */
+#define _GNU_SOURCE           /* syscall(), recvmmsg() and sendmmsg() */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#endif
 #include "emulator.h"
 #include "gbn.h"
+#include "results.h"
+#include "trace.h"
 
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  struct pktbuf *pktbuf;  /* packet (if any) assoc w/ this event, a reference to its buffer */
+  void *payload;          /* data for the handler of an extension event type */
+  unsigned long seq;      /* order of scheduling, for ties (see nextevent()) */
   struct event *prev;
   struct event *next;
 };
 
-struct event *evlist = NULL;   /* the event list */
+/* Pending events are not kept in one sorted list.  The medium cannot
+   reorder, so the arrivals towards each entity are already in time
+   order, and so are the packets each host finishes processing: each of
+   those streams is a plain FIFO, and scheduling into one is an append.
+   Each entity has at most one timer, which lives in its own slot.  The
+   few remaining events (the next layer 5 arrival, the application's next
+   read) go on a small sorted list.  The main loop takes whichever of
+   these heads is earliest, on a tie the one scheduled last, as a single
+   sorted list would. */
+struct evfifo {
+  struct event **ring;    /* power of two sized ring of events */
+  int head;               /* index of the oldest event */
+  int count;              /* number of events queued */
+  int size;               /* capacity of the ring */
+};
+
+struct event *evlist = NULL;   /* the event list: events that are not in a FIFO or timer slot */
+static struct evfifo arrivals[2];  /* packets in the medium, towards A and towards B */
+static struct evfifo hostdone[2];  /* packets being processed by host A and host B */
+static struct event *timers[2];    /* the running timer of A and of B, if any */
+static unsigned long evseq;        /* events scheduled so far */
 
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
+#define  HOST_DONE       3   /* host finished processing an arrived packet */
+#define  APP_DRAIN       4   /* application at B consumes a message */
+#define  MAXEVTYPES     32   /* most event types that can be registered */
+
+/* event type registry.  The main loop does not know the event types: it
+   looks the type up here and calls its dispatch routine.  The built in
+   types above are registered first, in that order, by registerbuiltins();
+   other modules add theirs with registerevent() and get the next free
+   number. */
+struct evtypeinfo {
+  const char *name;                  /* for traces and statistics */
+  int (*dispatch)(struct event *);   /* handle an event; returns 1 if it kept the event */
+  eventhandler handler;              /* extension types: called with entity and payload */
+};
+
+static struct evtypeinfo evtypes[MAXEVTYPES];
+static int nevtypes = 0;           /* number of registered event types */
 
 #define  OFF             0
 #define  ON              1
 
 int TRACE = 3;
 
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
+/* statistics updated by GBN and by the emulator's delivery of messages
+   are kept by stats.c (STAT_WINDOW_FULL and so on) */
 
 /* statistics updated by emulator */
 static int packets_lost;  
 static int packets_corrupt;
 static int packets_sent;
 static int packets_timeout;
-static int messages_delivered;
 
 static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
 static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
+static float simtime = 0.000;   /* the simulated clock */
 static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
 static float lambda;        /* arrival rate of messages from layer 5 */   
+static unsigned seed = 9999;      /* of the random number generator */
 static int   ntolayer3;           /* number sent into layer 3 */
 static int   nlost;               /* number lost in media */
 static int ncorrupt;              /* number corrupted by media*/
 
+/* channel schedule: the properties of the medium over time.  Entry 0 holds
+   the parameters entered at start up; a schedule file (named by the
+   EMU_SCHEDULE environment variable) appends entries that take effect at
+   the given simulated times.  Scheduled loss and corruption follow the
+   direction entered at start up, or EMU_SCHEDULE_DIRECTION (default both)
+   if none was asked for, even a loss of 1; only entries marked as
+   blackouts take both directions.  Packets are lost before they reach
+   the link, so a lost packet (and every packet in a blackout) takes none
+   of its bandwidth.  Each entry also collects statistics for the period
+   it was in force, so recovery after an outage can be measured. */
+struct chanphase {
+  float starttime;        /* simulated time this entry takes effect */
+  float lossprob;         /* probability that a packet is dropped */
+  int blackout;           /* every packet is dropped, in both directions */
+  float corruptprob;      /* probability that a packet is corrupted */
+  float mindelay;         /* one way delay is uniform on [mindelay,maxdelay] */
+  float maxdelay;
+  float bandwidth;        /* packets per time unit the link can carry, 0 = unlimited */
+  int nsent;              /* packets handed to the medium during this phase */
+  int nlost;              /* of which lost */
+  int ncorrupt;           /* of which corrupted */
+  int ndelivered;         /* messages delivered to layer 5 during this phase */
+  float firstdelivery;    /* time of the first delivery, < 0 if none */
+};
+
+static struct chanphase *schedule = NULL;  /* the schedule, sorted by starttime */
+static int nphases = 0;                    /* number of entries in the schedule */
+static int curphase = 0;                   /* entry currently in force */
+static float linkfree[2];                  /* time the link towards A/B is free to transmit */
+
+/* host processing model: each entity spends hostcost time units of CPU on
+   every packet it receives, one packet at a time.  Packets that arrive
+   while the host is busy wait in its service queue (of at most hostqlimit
+   packets, 0 = unlimited).  Costs come from EMU_PROC_A / EMU_PROC_B and
+   the queue limit from EMU_PROC_QUEUE; all default to 0, which is the
+   classic instantaneous host. */
+static float hostcost[2];          /* CPU time per received packet at A/B */
+static int hostqlimit;             /* service queue capacity */
+static float hostfree[2];          /* time A/B finishes the packets it has queued */
+static int hostqueued[2];          /* packets waiting for or in service at A/B */
+static int hostqmax[2];            /* largest service queue seen at A/B */
+static int hostprocessed[2];       /* packets A/B has finished processing */
+static int hostdropped[2];         /* packets A/B dropped because its queue was full */
+static double hostwait[2];         /* total time packets spent queued at A/B */
+
+/* application model at B: messages passed up by tolayer5() wait in an
+   application buffer of appcapacity messages (0 = unlimited) until the
+   application consumes them at apprate messages per time unit (0 = at
+   once).  Set by EMU_APP_RATE and EMU_APP_BUFFER.  Receivers see the free
+   space through tolayer5_space() and must hold back when it is 0. */
+static float apprate;              /* messages consumed per time unit */
+static int appcapacity;            /* size of the application buffer */
+static int appqueued;              /* messages waiting to be consumed */
+static int appqmax;                /* largest backlog seen */
+static int appconsumed;            /* messages the application has consumed */
+static int appoverflow;            /* messages lost because the buffer was full */
+
+/* message latency: the time from A accepting a message (A_output()
+   returning without counting it in window_full) to its delivery at B.
+   Both protocols deliver in order and exactly once, so the k-th message
+   delivered is the k-th accepted, and a FIFO of acceptance times is all
+   that is needed to match them up. */
+static float *accepttime;          /* ring of acceptance times of undelivered messages */
+static int acceptsize, accepthead, acceptcount;
+static float *latency;             /* latency of every message delivered */
+static int nlatency, latencysize;
+
+/* timeline export: with EMU_TIMELINE set to a file name, the run is also
+   written there as a Chrome trace-event file (chrome://tracing, Perfetto).
+   One simulated time unit is shown as one millisecond. */
+static FILE *timeline = NULL;      /* the timeline file, NULL if not exporting */
+static int tlfirst;                /* no event written yet (for the commas) */
+static float tltimer[2];           /* when A/B's running timer was started */
+static int tlinflight[2];          /* packets in the medium towards A/B */
+
+/* event trace: with EMU_TRACE set to a file name, every event handled is
+   recorded there in the compressed, time indexed format of trace.h,
+   a few bytes an event, for runs too long for a timeline. */
+static struct tracewriter *evtrace = NULL;  /* NULL if not tracing */
+static const char *evtracefile;
+static long evtracecount;          /* events recorded */
+
+/* hardware performance counters: with EMU_PERF set, the main loop reads
+   the CPU's counters around the handling of every event (including the
+   protocol callbacks it makes) and charges the difference to the event's
+   type.  Only on Linux, and only where perf_event_open() is allowed; if
+   it is not, the run carries on without counters. */
+#define PERF_NCOUNTERS 4
+static const char *perfname[PERF_NCOUNTERS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+static int perffd = -1;                           /* group leader, -1 if not counting */
+static int perfidx[PERF_NCOUNTERS];               /* position in a group read, -1 if not opened */
+static int perfopened;                            /* counters in the group */
+static unsigned long long perfstart[PERF_NCOUNTERS + 1]; /* counter values before this event */
+static unsigned long long perfsum[MAXEVTYPES][PERF_NCOUNTERS]; /* totals per event type */
+static long perfcount[MAXEVTYPES];                /* events measured per type */
+
+/* real-time pacing: with EMU_REALTIME set to a number of milliseconds,
+   one simulated time unit lasts that long on the wall clock and the main
+   loop holds each event back until its time has come, sleeping until
+   shortly before and spinning the rest of the way.  How long before is
+   learnt from how much the sleeps overshoot.  An event the loop
+   only gets to after its time is handled at once; how late it was is
+   recorded (in HIST_PACE_LAG, in microseconds), and so is the time spent
+   handling events, so the report
+   shows whether the simulation kept up and the highest event rate it
+   could run live. */
+#define PACE_SPIN     50e-6        /* least time before an event to stop sleeping and spin */
+#define PACE_MAXSPIN  5e-3         /* most */
+static double paceunit;            /* wall clock seconds per time unit, 0 = no pacing */
+static double paceepoch;           /* wall clock time of simulated time 0 */
+static double pacespin;            /* current spin margin, in seconds */
+static double pacebusy;            /* wall clock time spent handling events */
+
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
 /* isolate all random number generation in one location.  We assume that the*/
@@ -104,14 +275,70 @@ double jimsrand(void)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
+static void fifo_push(struct evfifo *f, struct event *p)
+{
+  struct event **ring;
+  int i;
+
+  if (f->count == f->size) {     /* full: double the ring, unwrapping it */
+    ring = malloc((f->size ? 2 * f->size : 16) * sizeof(struct event *));
+    if (ring == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<f->count; i++)
+      ring[i] = f->ring[(f->head + i) & (f->size - 1)];
+    free(f->ring);
+    f->ring = ring;
+    f->head = 0;
+    f->size = f->size ? 2 * f->size : 16;
+  }
+  f->ring[(f->head + f->count++) & (f->size - 1)] = p;
+}
+
+static struct event *fifo_head(struct evfifo *f)
+{
+  return f->count ? f->ring[f->head] : NULL;
+}
+
+static struct event *fifo_tail(struct evfifo *f)
+{
+  return f->count ? f->ring[(f->head + f->count - 1) & (f->size - 1)] : NULL;
+}
+
+static struct event *fifo_pop(struct evfifo *f)
+{
+  struct event *p = f->ring[f->head];
+
+  f->head = (f->head + 1) & (f->size - 1);
+  f->count--;
+  return p;
+}
+
+/* put an event where it belongs: arrivals and processed packets at the
+   back of their FIFO (they are never earlier than what is queued there),
+   timers in their slot, anything else into the sorted event list */
 void insertevent(struct event *p)
 {
   struct event *q,*qold;
 
   if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
+    printf("            INSERTEVENT: time is %f\n",simtime);
     printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
   }
+  p->seq = evseq++;
+  if (p->evtype == FROM_LAYER3) {
+    fifo_push(&arrivals[p->eventity], p);
+    return;
+  }
+  if (p->evtype == HOST_DONE) {
+    fifo_push(&hostdone[p->eventity], p);
+    return;
+  }
+  if (p->evtype == TIMER_INTERRUPT) {
+    timers[p->eventity] = p;
+    return;
+  }
   q = evlist;     /* q points to front of list in which p struct inserted */
   if (q==NULL) {   /* list is empty */
     evlist=p;
@@ -141,6 +368,51 @@ void insertevent(struct event *p)
   }
 }
 
+/* does p go before q (if any)?  The sorted list the heads stand in for
+   put an event in front of those at the same time, so on a tie the one
+   scheduled last goes first. */
+static int evbefore(const struct event *p, const struct event *q)
+{
+  return q == NULL || p->evtime < q->evtime || (p->evtime == q->evtime && p->seq > q->seq);
+}
+
+/* remove and return the earliest pending event, NULL if there are none */
+static struct event *nextevent(void)
+{
+  struct event *best, *p;
+  struct evfifo *bestfifo = NULL;
+  int i, besttimer = -1;
+
+  best = NULL;
+  for (i=0; i<2; i++)
+    if (timers[i] != NULL && evbefore(timers[i], best)) {
+      best = timers[i];
+      besttimer = i;
+    }
+  for (i=0; i<2; i++) {
+    if ((p = fifo_head(&arrivals[i])) != NULL && evbefore(p, best)) {
+      best = p;
+      bestfifo = &arrivals[i];
+    }
+    if ((p = fifo_head(&hostdone[i])) != NULL && evbefore(p, best)) {
+      best = p;
+      bestfifo = &hostdone[i];
+    }
+  }
+  if (evlist != NULL && evbefore(evlist, best)) {
+    best = evlist;
+    evlist = evlist->next;        /* remove this event from event list */
+    if (evlist!=NULL)
+      evlist->prev=NULL;
+    return best;
+  }
+  if (bestfifo != NULL)
+    return fifo_pop(bestfifo);
+  if (besttimer >= 0)
+    timers[besttimer] = NULL;
+  return best;
+}
+
 void generate_next_arrival(void)
 {
   double x;
@@ -156,7 +428,7 @@ void generate_next_arrival(void)
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
   }
-  evptr->evtime =  time + x;
+  evptr->evtime =  simtime + x;
   evptr->evtype =  FROM_LAYER5;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
@@ -168,311 +440,2288 @@ void generate_next_arrival(void)
 void printevlist(void)
 {
   struct event *q;
+  int i, j;
   printf("--------------\nEvent List Follows:\n");
+  for (i=0; i<2; i++) {
+    if ((q = timers[i]) != NULL)
+      printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+    for (j=0; j<arrivals[i].count; j++) {
+      q = arrivals[i].ring[(arrivals[i].head + j) & (arrivals[i].size - 1)];
+      printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+    }
+    for (j=0; j<hostdone[i].count; j++) {
+      q = hostdone[i].ring[(hostdone[i].head + j) & (hostdone[i].size - 1)];
+      printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+    }
+  }
   for(q = evlist; q!=NULL; q=q->next) {
     printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
   }
   printf("--------------\n");
 }
 
-void init(void)                         /* initialize the simulator */
+/* numeric simulator option from the environment, or dflt if not set */
+static float envfloat(const char *name, float dflt)
 {
-  float sum, avg;
-  int i;
+  char *value, *end;
+  float x;
 
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
+  if ((value = getenv(name)) == NULL || *value == '\0')
+    return dflt;
+  x = strtod(value, &end);
+  if (*end != '\0' || x < 0.0) {
+    printf("bad value for %s: %s\n", name, value);
+    exit(EXIT_FAILURE);
   }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
+  return x;
+}
 
+/********************* TIMELINE EXPORT *******/
 
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+/* Timeline layout: process 1 holds the A->B packets and process 2 the
+   B->A packets, with one thread (track) per sequence or ACK number, so
+   every transmission of a packet lines up on one row.  Process 3 holds
+   the timers, process 4 the deliveries to layer 5, and the counters
+   (packets in flight, window occupancy, queue lengths) are attached to
+   process 0. */
+#define TL_US(t)  ((double)(t) * 1000.0)
+
+static void tlevent(const char *fmt, ...);
+
+static void tlopen(const char *filename)
+{
+  static const char *names[] = {"counters", "A->B packets", "B->A packets", "timers", "layer 5"};
+  int i;
+
+  timeline = fopen(filename, "w");
+  if (timeline == NULL) {
+    printf("unable to open timeline file %s\n", filename);
     exit(EXIT_FAILURE);
   }
+  /* events are small and many: batch them into large writes */
+  setvbuf(timeline, NULL, _IOFBF, 1 << 20);
+  fprintf(timeline, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  tlfirst = 1;
+  for (i=0; i<5; i++)
+    tlevent("{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"%s\"}}", i, names[i]);
+  tlevent("{\"ph\":\"M\",\"pid\":3,\"tid\":0,\"name\":\"thread_name\",\"args\":{\"name\":\"A timer\"}}");
+  tlevent("{\"ph\":\"M\",\"pid\":3,\"tid\":1,\"name\":\"thread_name\",\"args\":{\"name\":\"B timer\"}}");
+}
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
+static void tlevent(const char *fmt, ...)
+{
+  va_list ap;
 
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+  if (!tlfirst)
+    fputs(",\n", timeline);
+  tlfirst = 0;
+  va_start(ap, fmt);
+  vfprintf(timeline, fmt, ap);
+  va_end(ap);
+}
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+/* a counter track sample */
+static void tlcounter(const char *name, double value)
+{
+  if (timeline != NULL)
+    tlevent("{\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"name\":\"%s\",\"args\":{\"value\":%g}}",
+            TL_US(simtime), name, value);
 }
 
-/********************** Student-callable ROUTINES ***********************/
+/* a packet sent by AorB: a span from now until it arrives, or a lost marker */
+static void tlpacket(int AorB, struct pkt *packet, struct event *evptr, int corrupted)
+{
+  int id;
 
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
-/* A or B is trying to stop timer */
+  if (timeline == NULL)
+    return;
+  id = AorB == A ? packet->seqnum : packet->acknum;
+  if (evptr == NULL)
+    tlevent("{\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"name\":\"lost\"}",
+            AorB + 1, id, TL_US(simtime));
+  else {
+    tlevent("{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s %d\"%s}",
+            AorB + 1, id, TL_US(simtime), TL_US(evptr->evtime - simtime), AorB == A ? "seq" : "ack", id,
+            corrupted ? ",\"args\":{\"corrupted\":1}" : "");
+    tlinflight[evptr->eventity]++;
+    tlcounter(AorB == A ? "in flight A->B" : "in flight B->A", tlinflight[evptr->eventity]);
+  }
+}
+
+/* a packet came out of the medium at AorB */
+static void tlarrival(int AorB)
 {
-  struct event *q;
+  if (timeline == NULL)
+    return;
+  tlinflight[AorB]--;
+  tlcounter(AorB == B ? "in flight A->B" : "in flight B->A", tlinflight[AorB]);
+}
 
-  if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+/* AorB's timer stopped or went off: draw the span it was running for */
+static void tltimerspan(int AorB, const char *how)
+{
+  if (timeline != NULL)
+    tlevent("{\"ph\":\"X\",\"pid\":3,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\"}",
+            AorB, TL_US(tltimer[AorB]), TL_US(simtime - tltimer[AorB]), how);
 }
 
+static void tlclose(void)
+{
+  if (timeline == NULL)
+    return;
+  fprintf(timeline, "\n]}\n");
+  fclose(timeline);
+  timeline = NULL;
+}
 
-void starttimer(int AorB, double increment)
-/* A or B is trying to start timer */
+/* window occupancy and other protocol state, reported by the protocols */
+void tracecounter(int AorB, const char *name, double value)
 {
+  char label[64];
 
-  struct event *q;
-  struct event *evptr;
+  if (timeline == NULL)
+    return;
+  sprintf(label, "%c %.40s", AorB == A ? 'A' : 'B', name);
+  tlcounter(label, value);
+}
 
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
-  /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
- 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
+/********************* EVENT TRACE *******/
+
+static void evtraceopen(const char *filename)
+{
+  evtrace = trace_create(filename);
+  if (evtrace == NULL)
     exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
-  evptr->evtype =  TIMER_INTERRUPT;
-   
- 
-  evptr->eventity = AorB;
-  insertevent(evptr);
-} 
+  evtracefile = filename;
+  evtracecount = 0;
+}
 
+/* record an event about to be handled (packet events still have their packet) */
+static void evtraceevent(struct event *eventptr)
+{
+  struct tracerec r;
 
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+  r.time = eventptr->evtime;
+  r.type = eventptr->evtype;
+  r.entity = eventptr->eventity;
+  r.haspkt = (eventptr->evtype == FROM_LAYER3 || eventptr->evtype == HOST_DONE) && eventptr->pktbuf != NULL;
+  r.seq = r.haspkt ? eventptr->pktbuf->pkt.seqnum : 0;
+  r.ack = r.haspkt ? eventptr->pktbuf->pkt.acknum : 0;
+  trace_add(evtrace, &r);
+  evtracecount++;
+}
+
+static void evtraceclose(void)
 {
-  struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
+  const char *names[MAXEVTYPES];
+  long size;
   int i;
 
-  ntolayer3++;
-
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being lost\n");
+  if (evtrace == NULL)
     return;
-  }  
+  for (i=0; i<nevtypes; i++)
+    names[i] = evtypes[i].name;
+  size = trace_finish(evtrace, names, nevtypes);
+  evtrace = NULL;
+  if (size < 0)
+    printf("event trace: writing %s failed\n", evtracefile);
+  else
+    printf("event trace: %ld events in %s, %ld bytes (%.2f per event)\n", evtracecount, evtracefile,
+           size, evtracecount > 0 ? (double)size / evtracecount : 0.0);
+}
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
-  }
+/********************* HARDWARE COUNTERS *******/
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+#ifdef __linux__
+static int perfopen1(unsigned long long config, int group)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group == -1;     /* the leader starts the whole group */
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void perfopen(void)
+{
+  static const unsigned long long config[PERF_NCOUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+  };
+  int i, fd;
+
+  perfopened = 0;
+  for (i=0; i<PERF_NCOUNTERS; i++) {
+    perfidx[i] = -1;
+    fd = perfopen1(config[i], perffd);
+    if (fd < 0) {
+      if (perffd < 0) {
+        printf("hardware counters unavailable (%s), continuing without them\n", strerror(errno));
+        return;
+      }
+      printf("hardware counter %s unavailable (%s)\n", perfname[i], strerror(errno));
+      continue;
+    }
+    if (perffd < 0)
+      perffd = fd;
+    perfidx[i] = perfopened++;
   }
-  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
-  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
+  ioctl(perffd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(perffd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
 
+/* read the group: v[0] is the number of counters, then their values */
+static int perfread(unsigned long long *v)
+{
+  return read(perffd, v, (perfopened + 1) * sizeof(unsigned long long)) > 0;
+}
+#else
+static void perfopen(void)
+{
+  printf("hardware counters are only supported on Linux, continuing without them\n");
+}
 
-  /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being corrupted\n");
-  }  
+static int perfread(unsigned long long *v)
+{
+  (void)v;
+  return 0;
+}
+#endif
 
-  if (TRACE>2)  
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
-} 
+static void perfbegin(void)
+{
+  if (perffd >= 0)
+    perfread(perfstart);
+}
 
-void tolayer5(int AorB, char datasent[20])
+static void perfend(int evtype)
 {
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A) 
-      printf("A: ");
-    else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
-  }
-  messages_delivered++;
+  unsigned long long now[PERF_NCOUNTERS + 1];
+  int i;
+
+  if (perffd < 0 || !perfread(now))
+    return;
+  perfcount[evtype]++;
+  for (i=0; i<PERF_NCOUNTERS; i++)
+    if (perfidx[i] >= 0)
+      perfsum[evtype][i] += now[perfidx[i] + 1] - perfstart[perfidx[i] + 1];
 }
 
-int main(void)
+/* per event type: instructions, cycles and misses per event, IPC, and
+   misses per thousand instructions */
+static void printperf(void)
 {
-  struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
+  double n, instr, cycles;
+  int t, i;
+
+  if (perffd < 0)
+    return;
+  printf("hardware counters per event type (per event; MPKI = misses per 1000 instructions):\n");
+  printf("  %-15s %9s %10s %10s %6s %10s %10s %8s %8s\n", "type", "events", "instr", "cycles",
+         "IPC", "cachemiss", "brmiss", "cacheMPKI", "brMPKI");
+  for (t=0; t<nevtypes; t++) {
+    if (perfcount[t] == 0)
+      continue;
+    n = perfcount[t];
+    instr = perfsum[t][1];
+    cycles = perfsum[t][0];
+    printf("  %-15s %9ld", evtypes[t].name, perfcount[t]);
+    for (i=0; i<2; i++)
+      if (perfidx[1-i] >= 0)
+        printf(" %10.1f", perfsum[t][1-i] / n);
       else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
-      }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+        printf(" %10s", "-");
+    if (perfidx[0] >= 0 && perfidx[1] >= 0 && cycles > 0)
+      printf(" %6.2f", instr / cycles);
+    else
+      printf(" %6s", "-");
+    for (i=2; i<4; i++)
+      if (perfidx[i] >= 0)
+        printf(" %10.2f", perfsum[t][i] / n);
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
-    }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
+        printf(" %10s", "-");
+    for (i=2; i<4; i++)
+      if (perfidx[i] >= 0 && perfidx[1] >= 0 && instr > 0)
+        printf(" %8.2f", 1000.0 * perfsum[t][i] / instr);
       else
-        B_timerinterrupt();
-    }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
-    }
-    free(eventptr);
+        printf(" %8s", "-");
+    printf("\n");
   }
+}
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+/********************* REAL-TIME PACING *******/
+
+static double wallclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* wait for the wall clock time of an event at simulated time evtime and
+   record how late it is; returns the wall clock time it is handled at */
+static double pacewait(float evtime)
+{
+  struct timespec ts;
+  double target, wake, now, over, lag;
+
+  target = paceepoch + evtime * paceunit;
+  now = wallclock();
+  if (target - now > pacespin) {
+    wake = target - pacespin;
+#ifdef __linux__
+    ts.tv_sec = (time_t)wake;
+    ts.tv_nsec = (long)((wake - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+#else
+    ts.tv_sec = (time_t)(wake - now);
+    ts.tv_nsec = (long)((wake - now - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+#endif
+    now = wallclock();
+    /* spin for longer straight away if the sleep overshot the margin,
+       and slowly shorten it again while sleeps are punctual */
+    over = now - wake;
+    if (over > pacespin)
+      pacespin = over < PACE_MAXSPIN ? over : PACE_MAXSPIN;
+    else
+      pacespin += (over - pacespin) / 64;
+    if (pacespin < PACE_SPIN)
+      pacespin = PACE_SPIN;
+  }
+  while (now < target)
+    now = wallclock();
+
+  lag = now - target;
+  stat_record(HIST_PACE_LAG, lag * 1e6);
+  return now;
+}
+
+static void printpacing(void)
+{
+  struct histogram lag;
+  double elapsed;
+
+  stat_histogram(HIST_PACE_LAG, &lag);
+  if (paceunit <= 0.0 || lag.count == 0)
+    return;
+  elapsed = wallclock() - paceepoch;
+  printf("real-time pacing at %g ms per time unit: %ld events in %.3f s\n",
+         paceunit * 1000.0, lag.count, elapsed);
+  printf("  lag behind the wall clock: mean %.1f us, p50 < %.0f us, p99 < %.0f us, max %.1f us (%.4f time units)\n",
+         lag.sum / lag.count, stat_percentile(&lag, 0.5), stat_percentile(&lag, 0.99),
+         lag.max, lag.max * 1e-6 / paceunit);
+  if (pacebusy > 0.0)
+    printf("  busy %.1f%% of the time; at most %.0f events/s (%.1f per time unit) could be run live\n",
+           100.0 * pacebusy / elapsed, lag.count / pacebusy, lag.count / pacebusy * paceunit);
+}
+
+/********************* CHANNEL SCHEDULE *******/
+
+/* add an entry to the end of the channel schedule */
+static struct chanphase *addphase(float starttime)
+{
+  struct chanphase *ph;
+
+  schedule = realloc(schedule, (nphases+1) * sizeof(struct chanphase));
+  if (schedule == 0) {
+    printf("memory allocation for channel schedule failed.");
+    exit(EXIT_FAILURE);
+  }
+  ph = &schedule[nphases++];
+  memset(ph, 0, sizeof(struct chanphase));
+  ph->starttime = starttime;
+  ph->firstdelivery = -1.0;
+  return ph;
+}
+
+/* read a channel schedule.  One entry per line:
+     <time> <lossprob> <corruptprob> <mindelay> <maxdelay> <bandwidth>
+     <time> blackout
+   Lines starting with '#' are comments.  Times must not decrease and
+   probabilities are in [0,1].  A blackout keeps the delay and bandwidth
+   of the previous entry but drops every packet, in both directions,
+   until the next entry takes effect; a plain loss of 1 only applies in
+   the direction the simulation impairs. */
+static void readschedule(const char *filename)
+{
+  FILE *fp;
+  char line[256], word[32];
+  struct chanphase *ph, prev;
+  float t;
+  int lineno = 0;
+  static int reads = 0;   /* sweeps re-read the schedule for every run */
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    printf("unable to open channel schedule %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if (sscanf(line, "%31s", word) != 1 || word[0] == '#')
+      continue;
+    prev = schedule[nphases-1];
+    if (sscanf(line, "%f %31s", &t, word) != 2 || t < prev.starttime) {
+      printf("channel schedule %s line %d: bad or out of order entry\n", filename, lineno);
+      exit(EXIT_FAILURE);
+    }
+    ph = addphase(t);
+    if (strcmp(word, "blackout") == 0) {
+      ph->blackout = 1;
+      ph->lossprob = 1.0;
+      ph->corruptprob = 0.0;
+      ph->mindelay = prev.mindelay;
+      ph->maxdelay = prev.maxdelay;
+      ph->bandwidth = prev.bandwidth;
+    }
+    else if (sscanf(line, "%f %f %f %f %f %f", &t, &ph->lossprob, &ph->corruptprob,
+                    &ph->mindelay, &ph->maxdelay, &ph->bandwidth) != 6
+             || ph->lossprob < 0.0 || ph->lossprob > 1.0 || ph->corruptprob < 0.0 || ph->corruptprob > 1.0
+             || ph->mindelay < 0.0 || ph->maxdelay < ph->mindelay || ph->bandwidth < 0.0) {
+      printf("channel schedule %s line %d: expected <time> <loss> <corrupt> <mindelay> <maxdelay> <bandwidth>\n",
+             filename, lineno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  fclose(fp);
+  if (reads++ == 0 && TRACE>0)
+    printf("read %d channel schedule entries from %s\n", nphases-1, filename);
+}
+
+/* the schedule entry in force at the current time.  Time never goes
+   backwards, so the cursor only has to move forward. */
+static struct chanphase *chanphase(void)
+{
+  while (curphase+1 < nphases && schedule[curphase+1].starttime <= simtime) {
+    curphase++;
+    if (TRACE>1)
+      printf("          CHANNEL: entering schedule entry %d at %f\n", curphase, simtime);
+  }
+  return &schedule[curphase];
+}
+
+/* per-phase statistics, printed at the end of a run with a schedule */
+static void printschedule(float endtime)
+{
+  struct chanphase *ph;
+  float end;
+  int i;
+
+  printf("channel schedule:\n");
+  printf("  %10s %10s %6s %6s %6s %6s %8s %10s %10s\n", "start", "end", "sent", "lost",
+         "corrupt", "deliv", "goodput", "state", "recovery");
+  for (i=0; i<nphases; i++) {
+    ph = &schedule[i];
+    end = (i+1 < nphases) ? schedule[i+1].starttime : endtime;
+    if (end < ph->starttime)
+      end = ph->starttime;
+    printf("  %10.2f %10.2f %6d %6d %6d %6d %8.4f %10s ", ph->starttime, end, ph->nsent,
+           ph->nlost, ph->ncorrupt, ph->ndelivered,
+           end > ph->starttime ? ph->ndelivered / (end - ph->starttime) : 0.0,
+           ph->blackout ? "blackout" : "");
+    /* recovery: how long after the phase began before data flowed again */
+    if (ph->firstdelivery >= 0.0)
+      printf("%10.2f\n", ph->firstdelivery - ph->starttime);
+    else
+      printf("%10s\n", "-");
+  }
+}
+
+/* put the simulator in its start state: statistics cleared, random
+   number generator seeded, channel as entered (no schedule), hosts and
+   application instantaneous, first message arrival scheduled.  Uses the
+   run parameters (nsimmax, lossprob, ...) as they stand. */
+static void resetsim(void)
+{
+  struct chanphase *ph;
+  float sum, avg;
+  int i;
+
+  srand(seed);              /* init random number generator */
+  sum = 0.0;                /* test random number generator for students */
+  for (i=0; i<1000; i++)
+    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
+  avg = sum/1000.0;
+  if (avg < 0.25 || avg > 0.75) {
+    printf("It is likely that random number generation on your machine\n" ); 
+    printf("is different from what this emulator expects.  Please take\n");
+    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* initialise statistics */
+  stat_reset();
+  packets_lost = 0;  
+  packets_corrupt = 0;
+  packets_sent = 0;
+  packets_timeout = 0;
+
+  ntolayer3 = 0;
+  nlost = 0;
+  ncorrupt = 0;
+  nsim = 0;
+
+  /* the parameters entered hold from time 0 until a schedule says otherwise */
+  nphases = 0;
+  curphase = 0;
+  linkfree[A] = linkfree[B] = 0.0;
+  ph = addphase(0.0);
+  ph->lossprob = lossprob;
+  ph->corruptprob = corruptprob;
+  ph->mindelay = 1.0;
+  ph->maxdelay = 10.0;
+  ph->bandwidth = 0.0;
+
+  hostqlimit = 0;
+  apprate = 0.0;
+  appcapacity = 0;
+  appqueued = appqmax = appconsumed = appoverflow = 0;
+  accepthead = acceptcount = 0;
+  nlatency = 0;
+  for (i=0; i<2; i++) {
+    hostcost[i] = 0.0;
+    hostfree[i] = 0.0;
+    hostqueued[i] = hostqmax[i] = 0;
+    hostprocessed[i] = hostdropped[i] = 0;
+    hostwait[i] = 0.0;
+  }
+  memset(perfsum, 0, sizeof(perfsum));
+  memset(perfcount, 0, sizeof(perfcount));
+  paceunit = 0.0;
+  pacebusy = 0.0;
+
+  simtime=0.0;                 /* initialize time to 0.0 */
+  generate_next_arrival();     /* initialize event list */
+}
+
+void init(void)                         /* initialize the simulator */
+{
+  char *schedfile, *tlfile, *tracefile;
+
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+
+  resetsim();
+
+  /* optional models and instrumentation, from the environment */
+  if ((schedfile = getenv("EMU_SCHEDULE")) != NULL && *schedfile != '\0') {
+    /* the direction is only asked for when there is loss or corruption
+       from the start; a schedule brings its own, in both directions
+       unless EMU_SCHEDULE_DIRECTION says otherwise */
+    if (lossprob == 0.0 && corruptprob == 0.0)
+      corruptdirection = (int)envfloat("EMU_SCHEDULE_DIRECTION", 2);
+    readschedule(schedfile);
+  }
+
+  hostcost[A] = envfloat("EMU_PROC_A", 0.0);
+  hostcost[B] = envfloat("EMU_PROC_B", 0.0);
+  hostqlimit = (int)envfloat("EMU_PROC_QUEUE", 0.0);
+
+  apprate = envfloat("EMU_APP_RATE", 0.0);
+  appcapacity = (int)envfloat("EMU_APP_BUFFER", 0.0);
+
+  if ((tlfile = getenv("EMU_TIMELINE")) != NULL && *tlfile != '\0') {
+    tlopen(tlfile);
+    tlinflight[A] = tlinflight[B] = 0;
+  }
+
+  if ((tracefile = getenv("EMU_TRACE")) != NULL && *tracefile != '\0')
+    evtraceopen(tracefile);
+
+  if (getenv("EMU_PERF") != NULL && perffd < 0)
+    perfopen();
+
+  paceunit = envfloat("EMU_REALTIME", 0.0) / 1000.0;
+}
+
+/********************* HOST PROCESSING *******/
+
+/* a packet has arrived at a host that charges CPU time for it.  The
+   arrival event is turned into a HOST_DONE event for the time the host
+   will have finished with the packet.  Returns 0 if the service queue was
+   full and the packet was dropped, in which case the caller still owns
+   the event. */
+static int hostenqueue(struct event *evptr)
+{
+  int AorB = evptr->eventity;
+  float start;
+
+  if (hostqlimit > 0 && hostqueued[AorB] >= hostqlimit) {
+    hostdropped[AorB]++;
+    if (TRACE>0)
+      printf("          HOST: %c service queue full, packet dropped\n", AorB == A ? 'A' : 'B');
+    pb_put(evptr->pktbuf);
+    return 0;
+  }
+  start = hostfree[AorB] > simtime ? hostfree[AorB] : simtime;
+  hostwait[AorB] += start - simtime;
+  hostfree[AorB] = start + hostcost[AorB];
+  if (++hostqueued[AorB] > hostqmax[AorB])
+    hostqmax[AorB] = hostqueued[AorB];
+  if (TRACE>2)
+    printf("          HOST: %c queues packet, %d waiting, done at %f\n", AorB == A ? 'A' : 'B',
+           hostqueued[AorB], hostfree[AorB]);
+  tlcounter(AorB == A ? "host queue A" : "host queue B", hostqueued[AorB]);
+  evptr->evtype = HOST_DONE;
+  evptr->evtime = hostfree[AorB];
+  insertevent(evptr);
+  return 1;
+}
+
+static void printhosts(void)
+{
+  int i;
+
+  for (i=0; i<2; i++) {
+    if (hostcost[i] <= 0.0)
+      continue;
+    printf("host %c: %f per packet, %d packets processed, %d dropped, max queue %d, average wait %f\n",
+           i == A ? 'A' : 'B', hostcost[i], hostprocessed[i], hostdropped[i], hostqmax[i],
+           hostprocessed[i] > 0 ? hostwait[i] / hostprocessed[i] : 0.0);
+  }
+}
+
+/* hand the packet carried by an event to the entity it is addressed to */
+static void deliverpacket(struct event *eventptr)
+{
+  struct pkt pkt2give;
+  int i;
+
+  pkt2give.seqnum = eventptr->pktbuf->pkt.seqnum;
+  pkt2give.acknum = eventptr->pktbuf->pkt.acknum;
+  pkt2give.checksum = eventptr->pktbuf->pkt.checksum;
+  for (i=0; i<20; i++)  
+    pkt2give.payload[i] = eventptr->pktbuf->pkt.payload[i];
+  pb_put(eventptr->pktbuf);        /* let go of the packet */
+  if (eventptr->eventity ==A)      /* deliver packet by calling */
+    A_input(pkt2give);            /* appropriate entity */
+  else
+    B_input(pkt2give);
+}
+
+/********************* APPLICATION MODEL *******/
+
+/* schedule the application's next read */
+static void scheduledrain(void)
+{
+  struct event *evptr;
+
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime = simtime + 1.0 / apprate;
+  evptr->evtype = APP_DRAIN;
+  evptr->eventity = B;
+  evptr->pktbuf = NULL;
+  insertevent(evptr);
+}
+
+/* the application consumes the oldest message in its buffer */
+static void appdrain(void)
+{
+  appqueued--;
+  appconsumed++;
+  tlcounter("application buffer", appqueued);
+  if (TRACE>2)
+    printf("          APP: message consumed, %d left in application buffer\n", appqueued);
+  if (appqueued > 0)
+    scheduledrain();
+}
+
+static void printapp(void)
+{
+  if (apprate <= 0.0)
+    return;
+  printf("application at B: rate %f, %d messages consumed, %d left unread, %d lost to overflow\n",
+         apprate, appconsumed, appqueued, appoverflow);
+  printf("application buffer peak: %d messages (%d bytes)\n", appqmax, appqmax * 20);
+}
+
+/********************* MESSAGE LATENCY *******/
+
+/* grow an array of floats to hold at least n, doubling */
+static float *growfloats(float *a, int *size, int n)
+{
+  int newsize = *size ? *size : 64;
+
+  while (newsize < n)
+    newsize *= 2;
+  if (newsize == *size)
+    return a;
+  a = realloc(a, newsize * sizeof(float));
+  if (a == 0) {
+    printf("memory allocation for latency statistics failed.");
+    exit(EXIT_FAILURE);
+  }
+  *size = newsize;
+  return a;
+}
+
+static void latencyaccept(void)
+{
+  float *ring;
+  int i, oldsize = acceptsize;
+
+  if (acceptcount == acceptsize) {   /* full: grow and unwrap */
+    ring = growfloats(NULL, &acceptsize, acceptcount + 1);
+    for (i=0; i<acceptcount; i++)
+      ring[i] = accepttime[(accepthead + i) % oldsize];
+    free(accepttime);
+    accepttime = ring;
+    accepthead = 0;
+  }
+  accepttime[(accepthead + acceptcount++) % acceptsize] = simtime;
+}
+
+/* the message accepted longest ago has left the protocol: delivered, in
+   which case its latency is recorded, or lost to a full application
+   buffer, which must still take it off the FIFO to keep the pairing */
+static void latencydeliver(int delivered)
+{
+  if (acceptcount == 0)
+    return;
+  if (delivered) {
+    latency = growfloats(latency, &latencysize, nlatency + 1);
+    latency[nlatency++] = simtime - accepttime[accepthead];
+  }
+  accepthead = (accepthead + 1) % acceptsize;
+  acceptcount--;
+}
+
+static int floatcmp(const void *x, const void *y)
+{
+  float a = *(const float *)x, b = *(const float *)y;
+
+  return (a > b) - (a < b);
+}
+
+/* sort the latencies, so percentiles can be read off, and return their mean */
+static double sortlatency(void)
+{
+  double sum = 0.0;
+  int i;
+
+  if (nlatency == 0)
+    return 0.0;
+  qsort(latency, nlatency, sizeof(float), floatcmp);
+  for (i=0; i<nlatency; i++)
+    sum += latency[i];
+  return sum / nlatency;
+}
+
+static void printlatency(void)
+{
+  double mean;
+
+  if (nlatency == 0)
+    return;
+  mean = sortlatency();
+  printf("message latency, A accepting to B delivering (%d messages): mean %.2f, p50 %.2f, p90 %.2f, "
+         "p99 %.2f, p99.9 %.2f, max %.2f\n", nlatency, mean,
+         latency[(int)(0.5 * (nlatency - 1))], latency[(int)(0.9 * (nlatency - 1))],
+         latency[(int)(0.99 * (nlatency - 1))], latency[(int)(0.999 * (nlatency - 1))],
+         latency[nlatency - 1]);
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+float get_sim_time(void)
+{
+  return simtime;
+}
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(int AorB)
+/* A or B is trying to stop timer */
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n",simtime);
+  if (timers[AorB] != NULL) {
+    free(timers[AorB]);
+    timers[AorB] = NULL;
+    tltimerspan(AorB, "stopped");
+    return;
+  }
+  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+}
+
+
+void starttimer(int AorB, double increment)
+/* A or B is trying to start timer */
+{
+
+  struct event *evptr;
+
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n",simtime);
+  /* be nice: check to see if timer is already started, if so, then  warn */
+  if (timers[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+ 
+  /* create future event for when timer goes off */
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime =  simtime + increment;
+  evptr->evtype =  TIMER_INTERRUPT;
+  tltimer[AorB] = simtime;
+   
+ 
+  evptr->eventity = AorB;
+  insertevent(evptr);
+} 
+
+
+/************************** TOLAYER3 ***************/
+/* channel_send(): run one packet through the medium.  Draws the loss,
+   delay and corruption outcomes for the packet and returns its arrival
+   event, or NULL if the packet was lost.  *lastime is the arrival time of
+   the last packet in flight towards the same destination; it is advanced
+   so that consecutive calls keep the medium in order.  The caller is
+   responsible for putting the event on the event list.  The caller's
+   reference to the packet's buffer passes to the event (or is dropped
+   with a lost packet). */
+/* are packets sent by AorB subject to loss and corruption?  (corruptdirection;
+   blackouts apply regardless) */
+static int impaired(int AorB)
+{
+  return !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+}
+
+static struct event *channel_send(int AorB, struct pktbuf *buf, float *lastime)
+{
+  struct pkt *packet = &buf->pkt;
+  struct event *evptr;
+  struct chanphase *ph;
+  float x = 0.0, departure;
+  int i, corrupted = 0;
+
+  ntolayer3++;
+  ph = chanphase();
+  ph->nsent++;
+
+  /* simulate losses (a blackout takes both directions).  The packet is
+     lost before it gets to the link, so it takes none of its bandwidth */
+  if ((jimsrand() < ph->lossprob && impaired(AorB)) || ph->blackout) {
+    nlost++;
+    ph->nlost++;
+    if (TRACE>0)    
+      printf("          TOLAYER3: packet being lost\n");
+    tlpacket(AorB, packet, NULL, 0);
+    pb_put(buf);
+    return NULL;
+  }  
+
+  if (TRACE>2)  {
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", packet->seqnum,
+           packet->acknum,  packet->checksum);
+    for (i=0; i<20; i++)
+      printf("%c",packet->payload[i]);
+    printf("\n");
+  }
+
+  /* create future event for arrival of packet at the other side */
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
+  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
+  evptr->pktbuf = buf;            /* the packet's buffer, shared, never copied */
+  /* a link of limited bandwidth has to finish sending what it already
+     has before this packet can leave */
+  if (ph->bandwidth > 0.0) {
+    departure = (linkfree[evptr->eventity] > simtime ? linkfree[evptr->eventity] : simtime)
+                + 1.0 / ph->bandwidth;
+    linkfree[evptr->eventity] = departure;
+    if (departure > *lastime)
+      *lastime = departure;
+  }
+  /* finally, compute the arrival time of packet at the other end.
+     medium can not reorder, so make sure packet arrives between mindelay
+     and maxdelay (1 and 10 unless scheduled otherwise) time units after
+     the latest arrival time of packets currently in the medium on their
+     way to the destination */
+  evptr->evtime =  *lastime + ph->mindelay + (ph->maxdelay - ph->mindelay)*jimsrand();
+  *lastime = evptr->evtime;
+
+  /* simulate corruption: */
+  if ((jimsrand() < ph->corruptprob) && impaired(AorB)) {
+    ncorrupt++;
+    ph->ncorrupt++;
+    corrupted = 1;
+    x = jimsrand();
+  }  
+  tlpacket(AorB, packet, evptr, corrupted);
+  if (corrupted) {
+    /* the sender (or another copy in the medium) may share the buffer:
+       corrupt a copy of our own */
+    evptr->pktbuf = pb_writable(evptr->pktbuf);
+    if (x < .75)
+      evptr->pktbuf->pkt.payload[0]='Z';   /* corrupt payload */
+    else if (x < .875)
+      evptr->pktbuf->pkt.seqnum = 999999;
+    else
+      evptr->pktbuf->pkt.acknum = 999999;
+    if (TRACE>0)    
+      printf("          TOLAYER3: packet being corrupted\n");
+  }  
+
+  if (TRACE>2)  
+    printf("          TOLAYER3: scheduling arrival on other side\n");
+  return evptr;
+}
+
+/* channel_tail(): arrival time of the last packet currently in the medium
+   on its way to entity AorB, or the current time if there is none */
+static float channel_tail(int AorB)
+{
+  struct event *q;
+
+  q = fifo_tail(&arrivals[AorB]);
+  return q != NULL ? q->evtime : simtime;
+}
+
+void tolayer3(int AorB, struct pkt packet)
+/* A or B is sending to network  */
+{
+  struct event *evptr;
+  float lastime;
+
+  /* copy the packet the student just gave me since he/she may decide to
+     do something with it after we return back to him/her */
+  lastime = channel_tail((AorB+1) % 2);
+  evptr = channel_send(AorB, pb_alloc(&packet), &lastime);
+  if (evptr != NULL)
+    insertevent(evptr);
+} 
+
+/* A or B is sending a packet it keeps in a buffer: the medium shares the
+   buffer, so however often the packet is sent it is never copied (unless
+   corrupted on the way) */
+void tolayer3_buf(int AorB, struct pktbuf *buf)
+{
+  struct event *evptr;
+  float lastime;
+
+  lastime = channel_tail((AorB+1) % 2);
+  evptr = channel_send(AorB, pb_get(buf), &lastime);
+  if (evptr != NULL)
+    insertevent(evptr);
+}
+
+/* A or B is sending n packets, kept in buffers (see tolayer3_buf()), to
+   the network in one go.  The channel outcomes are drawn packet by packet
+   in exactly the order n calls to tolayer3_buf() would draw them, so a
+   run gives the same result either way.  The difference is in the
+   bookkeeping: the tail of the medium is found once for the whole batch. */
+void tolayer3_bufbatch(int AorB, struct pktbuf *bufs[], int n)
+{
+  struct event *evptr;
+  float lastime;
+  int i;
+
+  lastime = channel_tail((AorB+1) % 2);
+  for (i=0; i<n; i++) {
+    evptr = channel_send(AorB, pb_get(bufs[i]), &lastime);
+    if (evptr != NULL)
+      insertevent(evptr);
+  }
+}
+
+/* how many more messages the application at A or B will accept right
+   now (INT_MAX if there is no limit).  Receivers should not accept (or
+   acknowledge) new data when this is 0. */
+int tolayer5_space(int AorB)
+{
+  if (AorB != B || apprate <= 0.0 || appcapacity <= 0)
+    return INT_MAX;
+  return appcapacity - appqueued;
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  struct chanphase *ph;
+  int i;  
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at ");
+    if (AorB == A) 
+      printf("A: ");
+    else
+      printf("B: ");
+    for (i=0; i<20; i++)  
+      printf("%c",datasent[i]);
+    printf("\n");
+  }
+  if (AorB == B && apprate > 0.0) {
+    if (appcapacity > 0 && appqueued >= appcapacity) {
+      appoverflow++;
+      latencydeliver(0);
+      if (TRACE>0)
+        printf("          TOLAYER5: application buffer full, message lost\n");
+      return;
+    }
+    if (appqueued++ == 0)
+      scheduledrain();
+    if (appqueued > appqmax)
+      appqmax = appqueued;
+  }
+  stat_add(STAT_MESSAGES_DELIVERED, 1);
+  if (AorB == B)
+    latencydeliver(1);
+  if (timeline != NULL) {
+    tlevent("{\"ph\":\"i\",\"s\":\"t\",\"pid\":4,\"tid\":%d,\"ts\":%.3f,\"name\":\"deliver %c\"}",
+            AorB, TL_US(simtime), datasent[1]);
+    tlcounter("application buffer", appqueued);
+  }
+  ph = chanphase();
+  ph->ndelivered++;
+  if (ph->firstdelivery < 0.0)
+    ph->firstdelivery = simtime;
+}
+
+/********************* EVENT DISPATCH *******/
+
+/* dispatch routines of the built in event types */
+
+static int dispatchtimer(struct event *eventptr)
+{
+  tltimerspan(eventptr->eventity, "timeout");
+  if (eventptr->eventity == A) 
+    A_timerinterrupt();
+  else
+    B_timerinterrupt();
+  return 0;
+}
+
+static int dispatchlayer5(struct event *eventptr)
+{
+  struct msg  msg2give;
+  int i,j;
+  long full;
+
+  if (nsim < nsimmax) {
+    generate_next_arrival();   /* set up future arrival */
+    /* fill in msg to give with string of same letter */    
+    j = nsim % 26; 
+    for (i=0; i<20; i++)  
+      msg2give.data[i] = 97 + j;
+    if (TRACE>2) {
+      printf("          MAINLOOP: data given to student: ");
+      for (i=0; i<20; i++) 
+        printf("%c", msg2give.data[i]);
+      printf("\n");
+    }
+    nsim++;
+    if (eventptr->eventity == A) {
+      full = stat_read(STAT_WINDOW_FULL);
+      A_output(msg2give);
+      if (stat_read(STAT_WINDOW_FULL) == full)
+        latencyaccept();
+    }
+    else
+      B_output(msg2give);  
+  }
+  else if (TRACE > 2)
+      printf("          FROM_LAYER5: no more messages to send: \n");
+  return 0;
+}
+
+static int dispatchlayer3(struct event *eventptr)
+{
+  tlarrival(eventptr->eventity);
+  if (hostcost[eventptr->eventity] > 0.0)
+    return hostenqueue(eventptr);  /* event comes back as HOST_DONE */
+  deliverpacket(eventptr);
+  return 0;
+}
+
+static int dispatchhostdone(struct event *eventptr)
+{
+  hostqueued[eventptr->eventity]--;
+  hostprocessed[eventptr->eventity]++;
+  tlcounter(eventptr->eventity == A ? "host queue A" : "host queue B", hostqueued[eventptr->eventity]);
+  deliverpacket(eventptr);
+  return 0;
+}
+
+static int dispatchappdrain(struct event *eventptr)
+{
+  (void)eventptr;
+  appdrain();
+  return 0;
+}
+
+/* extension types: hand the event's entity and payload to the registered handler */
+static int dispatchextension(struct event *eventptr)
+{
+  evtypes[eventptr->evtype].handler(eventptr->eventity, eventptr->payload);
+  return 0;
+}
+
+static int addevtype(const char *name, int (*dispatch)(struct event *), eventhandler handler)
+{
+  if (nevtypes == MAXEVTYPES) {
+    printf("too many event types registered\n");
+    exit(EXIT_FAILURE);
+  }
+  evtypes[nevtypes].name = name;
+  evtypes[nevtypes].dispatch = dispatch;
+  evtypes[nevtypes].handler = handler;
+  return nevtypes++;
+}
+
+/* register the built in event types, once, under their fixed numbers */
+static void registerbuiltins(void)
+{
+  if (nevtypes > 0)
+    return;
+  addevtype("timerinterrupt", dispatchtimer, NULL);
+  addevtype("fromlayer5", dispatchlayer5, NULL);
+  addevtype("fromlayer3", dispatchlayer3, NULL);
+  addevtype("hostdone", dispatchhostdone, NULL);
+  addevtype("appdrain", dispatchappdrain, NULL);
+}
+
+/* register a new event type; returns its number for scheduleevent() */
+int registerevent(const char *name, eventhandler handler)
+{
+  registerbuiltins();
+  return addevtype(name, dispatchextension, handler);
+}
+
+/* schedule an event of a registered type at entity A or B, delay time
+   units from now, carrying payload to its handler */
+void scheduleevent(int evtype, int AorB, double delay, void *payload)
+{
+  struct event *evptr;
+
+  if (evtype < 0 || evtype >= nevtypes) {
+    printf("INTERNAL PANIC: scheduling unknown event type %d\n", evtype);
+    exit(EXIT_FAILURE);
+  }
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime = simtime + delay;
+  evptr->evtype = evtype;
+  evptr->eventity = AorB;
+  evptr->pktbuf = NULL;
+  evptr->payload = payload;
+  insertevent(evptr);
+}
+
+/* run the simulation until there are no events left; returns the number
+   of events handled */
+static long runsim(void)
+{
+  struct event *eventptr;
+  int evtype, keep;
+  long nevents = 0;
+  double start = 0.0;
+
+  if (paceunit > 0.0) {
+    paceepoch = wallclock() - simtime * paceunit;
+    pacespin = PACE_SPIN;
+  }
+  while (1) {
+    eventptr = nextevent();       /* get next event to simulate */
+    if (eventptr==NULL)
+      return nevents;
+    evtype = eventptr->evtype;      /* (the event may be reused by its handler) */
+    if (evtype < 0 || evtype >= nevtypes) {
+      printf("INTERNAL PANIC: unknown event type \n");
+      free(eventptr);
+      continue;
+    }
+    if (TRACE>=2) {
+      printf("\nEVENT time: %f,",eventptr->evtime);
+      printf("  type: %d",evtype);
+      printf(", %s ", evtypes[evtype].name);
+      printf(" entity: %d\n",eventptr->eventity);
+    }
+    if (paceunit > 0.0)
+      start = pacewait(eventptr->evtime);
+    simtime = eventptr->evtime;     /* update time to next event time */
+    nevents++;
+    if (evtrace != NULL)
+      evtraceevent(eventptr);
+    perfbegin();
+    keep = evtypes[evtype].dispatch(eventptr);
+    perfend(evtype);
+    if (paceunit > 0.0)
+      pacebusy += wallclock() - start;
+    if (!keep)
+      free(eventptr);
+  }
+}
+
+/* end of run statistics */
+static void report(void)
+{
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",simtime,nsim);
+  printf("number of messages dropped due to full window:  %ld \n", stat_read(STAT_WINDOW_FULL));
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %ld \n", stat_read(STAT_NEW_ACKS));
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %ld \n", stat_read(STAT_PACKETS_RESENT));
+  printf("number of correct packets received at B:  %ld \n", stat_read(STAT_PACKETS_RECEIVED));
+  printf("number of messages delivered to application:  %ld \n", stat_read(STAT_MESSAGES_DELIVERED));
+  if (apprate > 0.0)
+    printf("number of messages lost to application buffer overflow:  %d \n", appoverflow);
+  printlatency();
+  if (pb_peak > 0)
+    printf("packet buffers: at most %ld held at once, %ld still held at the end\n", pb_peak, pb_live);
+  tlclose();
+  evtraceclose();
+  printperf();
+  printpacing();
+  printhosts();
+  printapp();
+  if (nphases > 1)
+    printschedule(simtime);
+}
+
+/********************* BENCHMARKS *******/
+
+/* With EMU_BENCH set, the emulator runs its benchmark suite instead of a
+   simulation: ns per operation for the hot emulator routines and
+   events/sec and goodput for a fixed set of scenarios, each repeated
+   EMU_BENCH_REPS times (default 7).  Results are compared with the
+   baseline in EMU_BENCH_FILE (default bench_baseline.txt).  A metric
+   regresses if it is worse than the baseline by more than
+   EMU_BENCH_THRESHOLD (relative, default 0.05) and Welch's t statistic
+   for the difference exceeds EMU_BENCH_T (default 3).  EMU_BENCH=save
+   also writes the results as the new baseline; any other value only
+   compares.  The exit status is 1 if anything regressed.
+
+   The fullwindow scenario sends faster than any window drains, so the
+   sender's window is always full and ACK processing walks it all the
+   time: it measures the window storage (the slot headers apart from the
+   packets) at whatever WINDOWSIZE the binary was built with.  Build with
+   e.g. -DWINDOWSIZE=64, 256 and 1024 and keep a baseline file for each;
+   the scenario's metrics carry the window size in their names, so a
+   baseline for another size is never compared with them.  GBN resends
+   its whole window at every timeout, so give it an RTT to match (about
+   six time units per slot, e.g. -DRTT=6000 for 1024) or its medium
+   backs up without bound.  Message sizes beyond one packet are
+   benchmarked by FRAG_BENCH (frag.c). */
+
+#ifndef BUILD_ID
+#ifdef __VERSION__
+#define BUILD_ID __DATE__ " " __TIME__ " cc " __VERSION__
+#else
+#define BUILD_ID __DATE__ " " __TIME__
+#endif
+#endif
+
+#define BENCH_MAXREPS    31
+#define BENCH_MAXMETRICS 32
+#define BENCH_MAXSCENARIOS 8
+
+struct benchscenario {
+  const char *name;
+  int nmsgs;
+  float lossprob;
+  float corruptprob;
+  float lambda;
+  int bywindow;           /* depends on WINDOWSIZE: named with it */
+};
+
+static const struct benchscenario benchscenarios[] = {
+  {"clean",      50000, 0.0,  0.0,  10.0, 0},
+  {"lossy",      50000, 0.2,  0.2,  10.0, 0},
+  {"saturated",  50000, 0.1,  0.1,   2.0, 0},
+  {"fullwindow", 50000, 0.05, 0.05,  0.01, 1}
+};
+
+struct benchmetric {
+  char name[48];
+  int higherbetter;       /* 1 if a larger value is an improvement */
+  int n;                  /* samples */
+  double mean;
+  double var;             /* sample variance */
+};
+
+static struct benchmetric benchresult[BENCH_MAXMETRICS];
+static int nbenchresult;
+
+static void benchrecord(const char *name, int higherbetter, const double *x, int n)
+{
+  struct benchmetric *m = &benchresult[nbenchresult++];
+  int i;
+
+  snprintf(m->name, sizeof(m->name), "%s", name);
+  m->higherbetter = higherbetter;
+  m->n = n;
+  m->mean = m->var = 0.0;
+  for (i=0; i<n; i++)
+    m->mean += x[i] / n;
+  for (i=0; i<n; i++)
+    m->var += (x[i] - m->mean) * (x[i] - m->mean) / (n > 1 ? n - 1 : 1);
+  printf("  %-28s %14.3f  (%s is better, %d runs)\n", m->name, m->mean,
+         higherbetter ? "higher" : "lower", n);
+}
+
+/* set the run parameters for a scenario and start it from scratch.  The
+   events left over are dropped without being dispatched; A_init() then
+   forgets any the protocol was waiting for, such as SR's pacing events. */
+static void benchsetup(int nmsgs, float loss, float corrupt, float arrival)
+{
+  struct event *q;
+
+  while ((q = nextevent()) != NULL) {   /* anything left over from a micro benchmark */
+    if (q->evtype == FROM_LAYER3 || q->evtype == HOST_DONE)
+      pb_put(q->pktbuf);
+    free(q);
+  }
+  nsimmax = nmsgs;
+  lossprob = loss;
+  corruptprob = corrupt;
+  corruptdirection = 2;
+  lambda = arrival;
+  resetsim();
+  A_init();
+  B_init();
+}
+
+/* insertevent: keep 64 packets in flight, spread over both directions
+   of the medium, and each operation schedules one more arrival and takes
+   the earliest pending event.  Reported as insertnext_ns: it measures
+   more than the insertevent_ns of older baselines did, so the two are
+   never compared. */
+static double benchinsertevent(long iters)
+{
+  static struct event pool[65];
+  struct event *p, *q;
+  double t0;
+  long n;
+  int i;
+
+  benchsetup(0, 0.0, 0.0, 1.0);
+  free(nextevent());           /* the first layer 5 arrival */
+  for (i=0; i<64; i++) {
+    pool[i].evtype = FROM_LAYER3;
+    pool[i].eventity = i % 2;
+    pool[i].evtime = channel_tail(i % 2) + 1 + 9 * jimsrand();
+    insertevent(&pool[i]);
+  }
+  p = &pool[64];
+  t0 = wallclock();
+  for (n=0; n<iters; n++) {
+    p->eventity = n % 2;
+    p->evtime = channel_tail(n % 2) + 1 + 9 * jimsrand();
+    insertevent(p);
+    p = nextevent();
+    simtime = p->evtime;
+  }
+  t0 = wallclock() - t0;
+  while ((q = nextevent()) != NULL)
+    ;
+  return t0 * 1e9 / iters;
+}
+
+/* tolayer3: send packets over a loss free channel, delivering the oldest
+   one (without calling the protocol) each time, so that the medium stays
+   at a steady depth */
+static double benchtolayer3(long iters)
+{
+  struct pkt packet;
+  struct event *q;
+  double t0;
+  long n;
+
+  benchsetup(0, 0.0, 0.0, 1.0);
+  memset(&packet, 'x', sizeof(packet));
+  packet.seqnum = packet.acknum = packet.checksum = 0;
+  t0 = wallclock();
+  for (n=0; n<iters; n++) {
+    tolayer3(A, packet);
+    if (n > 16 && (q = nextevent()) != NULL) {
+      simtime = q->evtime;
+      if (q->evtype == FROM_LAYER3)
+        pb_put(q->pktbuf);
+      free(q);
+    }
+  }
+  return (wallclock() - t0) * 1e9 / iters;
+}
+
+static int readbaseline(const char *filename, struct benchmetric *base, int max, char *build, int buildlen)
+{
+  FILE *fp;
+  char line[256], dir[16];
+  int n = 0;
+
+  build[0] = '\0';
+  if ((fp = fopen(filename, "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), fp) != NULL && n < max) {
+    if (strncmp(line, "build ", 6) == 0) {
+      snprintf(build, buildlen, "%s", line + 6);
+      build[strcspn(build, "\n")] = '\0';
+    }
+    else if (line[0] != '#' &&
+             sscanf(line, "%47s %15s %d %lf %lf", base[n].name, dir, &base[n].n, &base[n].mean,
+                    &base[n].var) == 5) {
+      base[n].higherbetter = strcmp(dir, "higher") == 0;
+      n++;
+    }
+  }
+  fclose(fp);
+  return n;
+}
+
+static void writebaseline(const char *filename)
+{
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen(filename, "w")) == NULL) {
+    printf("unable to write benchmark baseline %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(fp, "# metric better runs mean variance\n");
+  fprintf(fp, "build %s\n", BUILD_ID);
+  for (i=0; i<nbenchresult; i++)
+    fprintf(fp, "%s %s %d %.9g %.9g\n", benchresult[i].name,
+            benchresult[i].higherbetter ? "higher" : "lower", benchresult[i].n,
+            benchresult[i].mean, benchresult[i].var);
+  fclose(fp);
+  printf("baseline written to %s\n", filename);
+}
+
+/* compare the results with the baseline; returns the number of regressions */
+static int benchcompare(const struct benchmetric *base, int nbase, float threshold, float tcrit)
+{
+  const struct benchmetric *b, *m;
+  double worse, diff, se2, t2;
+  int i, j, regressions = 0;
+
+  printf("  %-28s %14s %14s %9s %9s\n", "metric", "baseline", "now", "gain", "t^2");
+  for (i=0; i<nbenchresult; i++) {
+    m = &benchresult[i];
+    for (b = NULL, j = 0; j < nbase; j++)
+      if (strcmp(base[j].name, m->name) == 0)
+        b = &base[j];
+    if (b == NULL) {
+      printf("  %-28s %14s %14.3f\n", m->name, "-", m->mean);
+      continue;
+    }
+    /* relative change, positive when worse */
+    worse = b->mean != 0.0 ? (m->mean - b->mean) / b->mean : 0.0;
+    if (m->higherbetter)
+      worse = -worse;
+    /* Welch's t, squared (so no square roots are needed).  Deterministic
+       metrics have no variance: any real change in them is significant */
+    se2 = m->var / m->n + b->var / b->n;
+    diff = m->mean - b->mean;
+    if ((diff < 0 ? -diff : diff) <= 1e-6 * (b->mean < 0 ? -b->mean : b->mean))
+      t2 = 0.0;
+    else if (se2 > 0.0)
+      t2 = diff * diff / se2;
+    else
+      t2 = 1e30;
+    printf("  %-28s %14.3f %14.3f %+8.1f%% ", m->name, b->mean, m->mean, -100.0 * worse);
+    if (t2 < 1e9)
+      printf("%9.1f", t2);
+    else
+      printf("%9s", "inf");
+    if (worse > threshold && t2 > (double)tcrit * tcrit) {
+      printf("  REGRESSION");
+      regressions++;
+    }
+    printf("\n");
+  }
+  return regressions;
+}
+
+static int benchmain(const char *mode)
+{
+  static struct benchmetric base[BENCH_MAXMETRICS];
+  const struct benchscenario *sc;
+  static double rate[BENCH_MAXSCENARIOS][BENCH_MAXREPS], goodput[BENCH_MAXSCENARIOS][BENCH_MAXREPS];
+  double insert[BENCH_MAXREPS], send[BENCH_MAXREPS];
+  char name[48], scname[24], basebuild[256];
+  const char *filename;
+  double t0;
+  long nevents;
+  int reps, nscen, nbase, r, i, regressions;
+  float threshold, tcrit;
+
+  reps = (int)envfloat("EMU_BENCH_REPS", 7);
+  if (reps < 2 || reps > BENCH_MAXREPS)
+    reps = reps < 2 ? 2 : BENCH_MAXREPS;
+  threshold = envfloat("EMU_BENCH_THRESHOLD", 0.05);
+  tcrit = envfloat("EMU_BENCH_T", 3.0);
+  filename = getenv("EMU_BENCH_FILE");
+  if (filename == NULL || *filename == '\0')
+    filename = "bench_baseline.txt";
+  TRACE = 0;
+
+  printf("benchmark, build %s\n", BUILD_ID);
+  /* repetitions are interleaved across benchmarks, so that a machine that
+     gets slower or faster during the run affects them all alike */
+  nscen = (int)(sizeof(benchscenarios)/sizeof(benchscenarios[0]));
+  benchinsertevent(200000);    /* warm up */
+  for (r=0; r<reps; r++) {
+    insert[r] = benchinsertevent(2000000);
+    send[r] = benchtolayer3(1000000);
+    for (i=0; i<nscen; i++) {
+      sc = &benchscenarios[i];
+      benchsetup(sc->nmsgs, sc->lossprob, sc->corruptprob, sc->lambda);
+      t0 = wallclock();
+      nevents = runsim();
+      t0 = wallclock() - t0;
+      rate[i][r] = nevents / t0;
+      goodput[i][r] = simtime > 0.0 ? stat_read(STAT_MESSAGES_DELIVERED) / simtime : 0.0;
+    }
+  }
+  nbenchresult = 0;
+  benchrecord("insertnext_ns", 0, insert, reps);
+  benchrecord("tolayer3_ns", 0, send, reps);
+  for (i=0; i<nscen; i++) {
+    sc = &benchscenarios[i];
+    if (sc->bywindow)
+      snprintf(scname, sizeof(scname), "%s_w%d", sc->name, protocol_window);
+    else
+      snprintf(scname, sizeof(scname), "%s", sc->name);
+    snprintf(name, sizeof(name), "%s_events_per_sec", scname);
+    benchrecord(name, 1, rate[i], reps);
+    snprintf(name, sizeof(name), "%s_goodput", scname);
+    benchrecord(name, 1, goodput[i], reps);
+  }
+
+  nbase = readbaseline(filename, base, BENCH_MAXMETRICS, basebuild, sizeof(basebuild));
+  regressions = 0;
+  if (nbase < 0)
+    printf("no baseline in %s\n", filename);
+  else {
+    printf("compared with baseline %s (build %s):\n", filename, basebuild);
+    regressions = benchcompare(base, nbase, threshold, tcrit);
+    printf("%d regression(s) beyond %.1f%% at t > %.1f\n", regressions, 100.0 * threshold, tcrit);
+  }
+  if (strcmp(mode, "save") == 0)
+    writebaseline(filename);
+  return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/********************* PARAMETER SWEEPS *******/
+
+/* With EMU_SWEEP=<file> the emulator runs every combination of the
+   comma separated lists in EMU_SWEEP_LOSS, EMU_SWEEP_CORRUPT and
+   EMU_SWEEP_LAMBDA (defaults 0, 0 and 10), EMU_SWEEP_REPS times each
+   (default 1, each repetition with its own seed), EMU_SWEEP_MSGS
+   messages a run (default 1000), and appends a row per run to the
+   columnar result store in file (see results.h).  A channel schedule in
+   EMU_SCHEDULE applies to every run, on top of the loss and corruption
+   swept.  Runs are made one after another in this process, as the
+   benchmarks do; query the store with rsquery (results.c).  New columns
+   only ever go at the end.  Appending to a store with another column
+   list is refused, so a store written before a column was added has to
+   be started afresh, though rsquery still reads it. */
+
+#define SWEEP_MAXVALUES 64
+
+static const struct rscol sweepcols[] = {
+  {"protocol", RS_STR8, 8}, {"window", RS_I32, 4}, {"loss", RS_F64, 8}, {"corrupt", RS_F64, 8},
+  {"lambda", RS_F64, 8}, {"msgs", RS_I32, 4}, {"seed", RS_I32, 4}, {"simtime", RS_F64, 8},
+  {"windowfull", RS_I64, 8}, {"acks", RS_I64, 8}, {"resent", RS_I64, 8},
+  {"received", RS_I64, 8}, {"delivered", RS_I64, 8}, {"goodput", RS_F64, 8},
+  {"latmean", RS_F64, 8}, {"latp99", RS_F64, 8}, {"rtt", RS_F64, 8}
+};
+
+/* the comma separated numbers in environment variable name (or dflt) */
+static int envlist(const char *name, const char *dflt, double *v, int max)
+{
+  const char *s = getenv(name);
+  char *end;
+  int n = 0;
+
+  if (s == NULL || *s == '\0')
+    s = dflt;
+  while (n < max) {
+    v[n] = strtod(s, &end);
+    if (end == s) {
+      printf("%s: not a list of numbers\n", name);
+      exit(EXIT_FAILURE);
+    }
+    n++;
+    if (*end != ',')
+      break;
+    s = end + 1;
+  }
+  return n;
+}
+
+static int sweepmain(const char *filename)
+{
+  double loss[SWEEP_MAXVALUES], corrupt[SWEEP_MAXVALUES], arrival[SWEEP_MAXVALUES];
+  union rsval row[sizeof(sweepcols) / sizeof(sweepcols[0])];
+  struct rswriter *w;
+  const char *schedfile = getenv("EMU_SCHEDULE");
+  int nloss, ncorrupt, narrival, nmsgs, reps, i, j, k, r, c;
+  long nruns = 0;
+  double t0;
+
+  nloss = envlist("EMU_SWEEP_LOSS", "0", loss, SWEEP_MAXVALUES);
+  ncorrupt = envlist("EMU_SWEEP_CORRUPT", "0", corrupt, SWEEP_MAXVALUES);
+  narrival = envlist("EMU_SWEEP_LAMBDA", "10", arrival, SWEEP_MAXVALUES);
+  nmsgs = (int)envfloat("EMU_SWEEP_MSGS", 1000);
+  reps = (int)envfloat("EMU_SWEEP_REPS", 1);
+  w = rs_create(filename, sweepcols, (int)(sizeof(sweepcols) / sizeof(sweepcols[0])));
+  if (w == NULL)
+    return EXIT_FAILURE;
+  TRACE = 0;
+
+  t0 = wallclock();
+  for (i=0; i<nloss; i++)
+    for (j=0; j<ncorrupt; j++)
+      for (k=0; k<narrival; k++)
+        for (r=0; r<reps; r++) {
+          seed = 9999 + r;
+          benchsetup(nmsgs, loss[i], corrupt[j], arrival[k]);
+          if (schedfile != NULL && *schedfile != '\0')
+            readschedule(schedfile);
+          runsim();
+          memset(row, 0, sizeof(row));
+          c = 0;
+          strncpy(row[c++].str8, protocol_name, sizeof(row[0].str8));
+          row[c++].i32 = protocol_window;
+          row[c++].f64 = loss[i];
+          row[c++].f64 = corrupt[j];
+          row[c++].f64 = arrival[k];
+          row[c++].i32 = nmsgs;
+          row[c++].i32 = (int32_t)seed;
+          row[c++].f64 = simtime;
+          row[c++].i64 = stat_read(STAT_WINDOW_FULL);
+          row[c++].i64 = stat_read(STAT_NEW_ACKS);
+          row[c++].i64 = stat_read(STAT_PACKETS_RESENT);
+          row[c++].i64 = stat_read(STAT_PACKETS_RECEIVED);
+          row[c++].i64 = stat_read(STAT_MESSAGES_DELIVERED);
+          row[c++].f64 = simtime > 0.0 ? stat_read(STAT_MESSAGES_DELIVERED) / simtime : 0.0;
+          row[c++].f64 = sortlatency();
+          row[c++].f64 = nlatency > 0 ? latency[(int)(0.99 * (nlatency - 1))] : 0.0;
+          row[c++].f64 = protocol_rtt;
+          rs_add(w, row);
+          nruns++;
+        }
+  seed = 9999;
+  if (rs_close(w) < 0) {
+    printf("sweep: writing %s failed\n", filename);
+    return EXIT_FAILURE;
+  }
+  printf("%ld runs of %s in %.2f s appended to %s\n", nruns, protocol_name, wallclock() - t0, filename);
+  return EXIT_SUCCESS;
+}
+
+/********************* AUTOTUNING *******/
+
+/* With EMU_TUNE=<file> the emulator picks the best of a set of protocol
+   configurations for one channel profile.  The protocol, WINDOWSIZE and
+   RTT are compile time constants, so each configuration is a build of
+   its own: the candidates are emulator binaries, space separated in
+   EMU_TUNE_BINS, built with gbn.c or sr.c and -DWINDOWSIZE=, -DRTT= as
+   wanted.  The search is successive halving: every candidate runs a
+   sweep (see above) of EMU_TUNE_REPS seeds (default 3) of EMU_TUNE_MSGS
+   messages (default 500), the better half go on to a round with twice
+   the messages, and so on until one is left.  Better is higher goodput
+   among candidates whose mean p99 latency is within EMU_TUNE_P99
+   (default no bound), then lower p99 latency for the rest.  Up to
+   EMU_TUNE_JOBS candidates (default one per CPU) run at once.
+
+   The channel profile is set as for a sweep, with single values in
+   EMU_SWEEP_LOSS, EMU_SWEEP_CORRUPT and EMU_SWEEP_LAMBDA and, for
+   anything more (the delay distribution, bandwidth), EMU_SCHEDULE.
+   Candidate i keeps its rows in the result store file.i (replaced at the
+   start); the results of each round are printed as it ends, and at the
+   end the Pareto frontier of goodput against p99 latency.  The frontier
+   compares the candidates on the first round, the only one all of them
+   ran, so none is measured on longer runs than another. */
+
+#ifdef __linux__
+#define TUNE_MAXCANDS 64
+
+struct tunecand {
+  const char *bin;
+  char store[256];        /* its result store */
+  char label[48];         /* protocol, window and RTT, from its results */
+  int alive;              /* still in the running */
+  int failed;
+  int msgs;               /* messages a run in the last round it ran in */
+  double goodput;         /* means over that round's runs */
+  double p99;
+};
+
+static struct tunecand tunecands[TUNE_MAXCANDS];
+static double tunebound;   /* p99 latency bound */
+
+/* fork and exec candidate c for a sweep of msgs messages and reps seeds */
+static pid_t tunestart(struct tunecand *c, int msgs, int reps)
+{
+  char value[32];
+  pid_t pid;
+  int fd;
+
+  fflush(stdout);
+  if ((pid = fork()) != 0)
+    return pid;
+  unsetenv("EMU_TUNE");
+  setenv("EMU_SWEEP", c->store, 1);
+  snprintf(value, sizeof(value), "%d", msgs);
+  setenv("EMU_SWEEP_MSGS", value, 1);
+  snprintf(value, sizeof(value), "%d", reps);
+  setenv("EMU_SWEEP_REPS", value, 1);
+  if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+    dup2(fd, STDOUT_FILENO);
+  execl(c->bin, c->bin, (char *)NULL);
+  _exit(127);
+}
+
+/* read candidate c's results for runs of msgs messages; 0 if there are none */
+static int tuneread(struct tunecand *c, int msgs)
+{
+  struct rsstore st;
+  struct rsblock b;
+  union rsval v;
+  int cm, cg, cp, cproto, cwin, crtt, i, n = 0, more;
+
+  if (rs_open(&st, c->store) < 0)
+    return 0;
+  cm = rs_column(&st, "msgs");
+  cg = rs_column(&st, "goodput");
+  cp = rs_column(&st, "latp99");
+  cproto = rs_column(&st, "protocol");
+  cwin = rs_column(&st, "window");
+  crtt = rs_column(&st, "rtt");
+  c->goodput = c->p99 = 0.0;
+  if (cm >= 0 && cg >= 0 && cp >= 0 && cproto >= 0 && cwin >= 0 && crtt >= 0)
+    for (more = rs_firstblock(&st, &b); more; more = rs_nextblock(&st, &b))
+      for (i=0; i<b.nrows; i++) {
+        if (rs_value(&st, &b, cm, i).i32 != msgs)
+          continue;
+        c->goodput += rs_value(&st, &b, cg, i).f64;
+        c->p99 += rs_value(&st, &b, cp, i).f64;
+        if (n++ == 0) {
+          v = rs_value(&st, &b, cproto, i);
+          snprintf(c->label, sizeof(c->label), "%.8s w=%d rtt=%g", v.str8,
+                   (int)rs_value(&st, &b, cwin, i).i32, rs_value(&st, &b, crtt, i).f64);
+        }
+      }
+  rs_unmap(&st);
+  if (n == 0)
+    return 0;
+  c->goodput /= n;
+  c->p99 /= n;
+  c->msgs = msgs;
+  return 1;
+}
+
+/* order candidates best first */
+static int tunecmp(const void *x, const void *y)
+{
+  const struct tunecand *a = *(struct tunecand *const *)x, *b = *(struct tunecand *const *)y;
+  int oka = a->p99 <= tunebound, okb = b->p99 <= tunebound;
+
+  if (oka != okb)
+    return okb - oka;
+  if (oka && a->goodput != b->goodput)
+    return a->goodput < b->goodput ? 1 : -1;
+  return (a->p99 > b->p99) - (a->p99 < b->p99);
+}
+
+static void tuneheader(void)
+{
+  printf("  %-28s %-24s %8s %12s %12s\n", "configuration", "binary", "msgs", "goodput", "p99 latency");
+}
+
+static void tuneprint(struct tunecand *c)
+{
+  printf("  %-28s %-24s %8d %12.5f %12.2f%s\n", c->label, c->bin, c->msgs, c->goodput, c->p99,
+         c->p99 <= tunebound ? "" : "  over bound");
+}
+
+static int tunemain(const char *filename)
+{
+  struct tunecand *order[TUNE_MAXCANDS], *c;
+  pid_t pids[TUNE_MAXCANDS], pid;
+  char *bins, *bin;
+  int ncands = 0, nalive, msgs, first, reps, jobs, running, next, status, round, i, j, dominated;
+
+  bins = getenv("EMU_TUNE_BINS");
+  if (bins == NULL || *bins == '\0') {
+    printf("EMU_TUNE_BINS: no candidate binaries given\n");
+    return EXIT_FAILURE;
+  }
+  bins = strdup(bins);
+  for (bin = strtok(bins, " \t"); bin != NULL && ncands < TUNE_MAXCANDS; bin = strtok(NULL, " \t")) {
+    c = &tunecands[ncands];
+    c->bin = bin;
+    c->alive = 1;
+    snprintf(c->store, sizeof(c->store), "%s.%d", filename, ncands);
+    snprintf(c->label, sizeof(c->label), "%s", bin);
+    unlink(c->store);
+    ncands++;
+  }
+  msgs = (int)envfloat("EMU_TUNE_MSGS", 500);
+  reps = (int)envfloat("EMU_TUNE_REPS", 3);
+  jobs = (int)envfloat("EMU_TUNE_JOBS", (float)sysconf(_SC_NPROCESSORS_ONLN));
+  tunebound = envfloat("EMU_TUNE_P99", 0.0);
+  if (tunebound <= 0.0)
+    tunebound = 1e300;
+  if (jobs < 1)
+    jobs = 1;
+
+  first = msgs;
+  nalive = ncands;
+  for (round=1; nalive > 0; round++, msgs *= 2) {
+    /* run this round's candidates, at most jobs at a time */
+    for (i=0; i<ncands; i++)
+      pids[i] = 0;
+    running = next = 0;
+    while (next < ncands || running > 0) {
+      if (next < ncands && running < jobs) {
+        if (tunecands[next].alive && (pids[next] = tunestart(&tunecands[next], msgs, reps)) > 0)
+          running++;
+        else if (tunecands[next].alive) {
+          printf("tune: cannot start %s: %s\n", tunecands[next].bin, strerror(errno));
+          tunecands[next].failed = 1;
+        }
+        next++;
+        continue;
+      }
+      if ((pid = wait(&status)) < 0)
+        break;
+      running--;
+      for (i=0; i<ncands && pids[i] != pid; i++)
+        ;
+      if (i < ncands && (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !tuneread(&tunecands[i], msgs))) {
+        printf("tune: %s failed (exit status %d)\n", tunecands[i].bin, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        tunecands[i].failed = 1;
+      }
+    }
+
+    /* keep the better half */
+    nalive = 0;
+    for (i=0; i<ncands; i++) {
+      if (tunecands[i].failed)
+        tunecands[i].alive = 0;
+      if (tunecands[i].alive)
+        order[nalive++] = &tunecands[i];
+    }
+    qsort(order, nalive, sizeof(order[0]), tunecmp);
+    printf("round %d, %d messages x %d seeds:\n", round, msgs, reps);
+    tuneheader();
+    for (i=0; i<nalive; i++)
+      tuneprint(order[i]);
+    if (nalive <= 1)
+      break;
+    for (i=(nalive + 1) / 2; i<nalive; i++)
+      order[i]->alive = 0;
+    nalive = (nalive + 1) / 2;
+  }
+  if (nalive == 0) {
+    printf("tune: no candidate ran\n");
+    return EXIT_FAILURE;
+  }
+  printf("best: %s (%s)\n", order[0]->label, order[0]->bin);
+
+  /* the frontier: candidates no other beats on both goodput and p99,
+     all as of the first round */
+  printf("Pareto frontier, goodput against p99 latency, %d messages x %d seeds:\n", first, reps);
+  tuneheader();
+  for (i=nalive=0; i<ncands; i++)
+    if (!tunecands[i].failed && tuneread(&tunecands[i], first))
+      order[nalive++] = &tunecands[i];
+  tunebound = 1e300;
+  qsort(order, nalive, sizeof(order[0]), tunecmp);
+  for (i=0; i<nalive; i++) {
+    dominated = 0;
+    for (j=0; j<nalive && !dominated; j++)
+      dominated = order[j]->goodput >= order[i]->goodput && order[j]->p99 <= order[i]->p99 &&
+                  (order[j]->goodput > order[i]->goodput || order[j]->p99 < order[i]->p99);
+    if (!dominated)
+      tuneprint(order[i]);
+  }
+  return EXIT_SUCCESS;
+}
+#else
+static int tunemain(const char *filename)
+{
+  (void)filename;
+  printf("autotuning is only supported on Linux\n");
+  return EXIT_FAILURE;
+}
+#endif
+
+/********************* UDP IMPAIRMENT PROXY *******/
+
+/* With EMU_PROXY="<listen port> <server port>" the emulator does not
+   simulate anything: it becomes a UDP relay on the loopback interface
+   that puts real traffic through the same channel model as tolayer3().
+   A client sends to the listen port; its datagrams (direction A->B) are
+   forwarded to the server port, and the server's replies (B->A) go back
+   to the client.  Each datagram may be lost, corrupted (one byte
+   flipped) or delayed, and is released in real time, in order, when its
+   arrival time comes.  The parameters are those of the simulator:
+   EMU_PROXY_LOSS, EMU_PROXY_CORRUPT and EMU_PROXY_DIRECTION (0 A->B,
+   1 A<-B, 2 both; the default) for the channel, EMU_SCHEDULE for changes
+   over time, and one simulated time unit is EMU_PROXY_UNIT milliseconds
+   (default 1), so the default delay is 1 to 10 ms.  Unlike tolayer3(),
+   which starts a packet's delay when the one before it arrives, the
+   delay runs from when the datagram is received (still without
+   reordering), so the rate the relay sustains is set by the sender or
+   EMU_SCHEDULE's bandwidth, not by the delay.  Receiving and
+   sending is done in batches with recvmmsg()/sendmmsg().  Only one
+   client is tracked: replies go to the address the last datagram to the
+   listen port came from.  The proxy runs until interrupted, then prints
+   its statistics. */
+
+#ifdef __linux__
+#define PROXY_SLOTS   4096     /* datagrams that can be in flight each way (power of two) */
+#define PROXY_MTU     2048     /* largest datagram relayed */
+#define PROXY_BATCH   64       /* datagrams per recvmmsg()/sendmmsg() */
+
+/* the medium in one direction: a FIFO of datagrams waiting for their
+   arrival time, each received straight into its slot */
+struct proxychan {
+  unsigned char *buf;          /* PROXY_SLOTS buffers of PROXY_MTU bytes */
+  int len[PROXY_SLOTS];        /* datagram length, -1 if lost in the medium */
+  double due[PROXY_SLOTS];     /* wall clock time (in units) it arrives */
+  int head, count;
+  double lastdue;              /* arrival time of the last datagram in flight */
+  double linkfree;             /* when the link has finished sending, with a bandwidth */
+  int from;                    /* A or B: the sending side */
+  long nrecv, nlost, ncorrupt, nsent, nfull, ntrunc;
+  long nerror;                 /* errors reported by the receiving side, e.g. port unreachable */
+};
+
+static volatile sig_atomic_t proxystop;
+static double proxyunit;       /* seconds per simulated time unit */
+static struct timespec proxyepoch;
+
+static void proxysignal(int sig)
+{
+  (void)sig;
+  proxystop = 1;
+}
+
+/* wall clock time since the proxy started, in simulated time units */
+static double proxynow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((ts.tv_sec - proxyepoch.tv_sec) + (ts.tv_nsec - proxyepoch.tv_nsec) * 1e-9) / proxyunit;
+}
+
+/* decide the fate of the datagram just received into slot i of ch,
+   drawing from the channel model in the same order as channel_send() */
+static void proxyimpair(struct proxychan *ch, int i, double now)
+{
+  struct chanphase *ph;
+  unsigned char *data = ch->buf + (size_t)i * PROXY_MTU;
+  double departure, base;
+  int AorB = ch->from;
+
+  simtime = now;               /* for chanphase() only */
+  ph = chanphase();
+  ph->nsent++;
+  ch->nrecv++;
+  base = now;
+  if ((jimsrand() < ph->lossprob && impaired(AorB)) || ph->blackout) {
+    ph->nlost++;
+    ch->nlost++;
+    ch->len[i] = -1;
+    ch->due[i] = ch->lastdue > now ? ch->lastdue : now;   /* holds nothing up */
+    return;
+  }
+  if (ph->bandwidth > 0.0) {
+    departure = (ch->linkfree > now ? ch->linkfree : now) + 1.0 / ph->bandwidth;
+    ch->linkfree = departure;
+    if (departure > base)
+      base = departure;
+  }
+  ch->due[i] = base + ph->mindelay + (ph->maxdelay - ph->mindelay)*jimsrand();
+  if (ch->due[i] < ch->lastdue)
+    ch->due[i] = ch->lastdue;  /* the medium does not reorder */
+  ch->lastdue = ch->due[i];
+  if ((jimsrand() < ph->corruptprob) && ch->len[i] > 0 && impaired(AorB)) {
+    ph->ncorrupt++;
+    ch->ncorrupt++;
+    data[(int)(jimsrand() * (ch->len[i] - 1))] ^= 0x5a;
+  }
+}
+
+/* receive as many datagrams as are waiting on fd (up to the free space)
+   into the channel; returns the client address in *peer if wanted */
+static void proxyrecv(int fd, struct proxychan *ch, struct sockaddr_in *peer, double now)
+{
+  struct mmsghdr msgs[PROXY_BATCH];
+  struct iovec iov[PROXY_BATCH];
+  struct sockaddr_in addr[PROXY_BATCH];
+  int n, i, slot, room;
+
+  while ((room = PROXY_SLOTS - ch->count) > 0) {
+    if (room > PROXY_BATCH)
+      room = PROXY_BATCH;
+    memset(msgs, 0, room * sizeof(msgs[0]));
+    for (i=0; i<room; i++) {
+      slot = (ch->head + ch->count + i) & (PROXY_SLOTS - 1);
+      iov[i].iov_base = ch->buf + (size_t)slot * PROXY_MTU;
+      iov[i].iov_len = PROXY_MTU;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &addr[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+    }
+    n = recvmmsg(fd, msgs, room, MSG_DONTWAIT, NULL);
+    if (n <= 0)
+      return;
+    for (i=0; i<n; i++) {
+      slot = (ch->head + ch->count) & (PROXY_SLOTS - 1);
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        ch->ntrunc++;          /* too big to relay; the slot is reused */
+        continue;
+      }
+      if (peer != NULL)
+        *peer = addr[i];
+      ch->len[slot] = (int)msgs[i].msg_len;
+      /* a truncated datagram before this one leaves a gap: close it up */
+      if (iov[i].iov_base != ch->buf + (size_t)slot * PROXY_MTU)
+        memmove(ch->buf + (size_t)slot * PROXY_MTU, iov[i].iov_base, msgs[i].msg_len);
+      ch->count++;
+      proxyimpair(ch, slot, now);
+    }
+    if (n < room)
+      return;
+  }
+  ch->nfull++;                 /* left waiting in the socket buffer */
+}
+
+/* send every datagram whose arrival time has come; to is NULL for a
+   connected socket */
+static void proxysend(int fd, struct proxychan *ch, const struct sockaddr_in *to, double now)
+{
+  struct mmsghdr msgs[PROXY_BATCH];
+  struct iovec iov[PROXY_BATCH];
+  int n, i, slot;
+
+  while (ch->count > 0) {
+    /* datagrams lost in the medium just leave the queue */
+    while (ch->count > 0 && ch->len[ch->head] < 0 && ch->due[ch->head] <= now) {
+      ch->head = (ch->head + 1) & (PROXY_SLOTS - 1);
+      ch->count--;
+    }
+    memset(msgs, 0, sizeof(msgs));
+    for (n=0; n<PROXY_BATCH && n<ch->count; n++) {
+      slot = (ch->head + n) & (PROXY_SLOTS - 1);
+      if (ch->due[slot] > now || ch->len[slot] < 0)
+        break;
+      iov[n].iov_base = ch->buf + (size_t)slot * PROXY_MTU;
+      iov[n].iov_len = ch->len[slot];
+      msgs[n].msg_hdr.msg_iov = &iov[n];
+      msgs[n].msg_hdr.msg_iovlen = 1;
+      if (to != NULL) {
+        msgs[n].msg_hdr.msg_name = (void *)to;
+        msgs[n].msg_hdr.msg_namelen = sizeof(*to);
+      }
+    }
+    if (n == 0)
+      return;
+    i = sendmmsg(fd, msgs, n, MSG_DONTWAIT);
+    if (i <= 0)
+      return;                  /* socket buffer full: try again next time round */
+    ch->head = (ch->head + i) & (PROXY_SLOTS - 1);
+    ch->count -= i;
+    ch->nsent += i;
+    if (i < n)
+      return;
+  }
+}
+
+/* clear the error pending on fd, counting it against ch, the direction
+   sent through fd.  Until it is read poll() keeps reporting it. */
+static void proxyerror(int fd, struct proxychan *ch)
+{
+  socklen_t len = sizeof(int);
+  int err = 0;
+
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0)
+    ch->nerror++;
+}
+
+static int proxysocket(int port, int connectto)
+{
+  struct sockaddr_in addr;
+  int fd, size = 4 << 20;
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    printf("proxy: socket: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if ((connectto ? connect(fd, (struct sockaddr *)&addr, sizeof(addr))
+                 : bind(fd, (struct sockaddr *)&addr, sizeof(addr))) < 0) {
+    printf("proxy: %s port %d: %s\n", connectto ? "connect to" : "bind", port, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+static void proxystats(const char *name, struct proxychan *ch, double elapsed)
+{
+  printf("%s: %ld received, %ld lost, %ld corrupted, %ld relayed (%.0f/s), %ld too large, "
+         "%d still in flight, receive ring full %ld times, %ld send errors\n", name, ch->nrecv,
+         ch->nlost, ch->ncorrupt, ch->nsent, elapsed > 0.0 ? ch->nsent / elapsed : 0.0, ch->ntrunc,
+         ch->count, ch->nfull, ch->nerror);
+}
+
+static int proxymain(const char *spec)
+{
+  static struct proxychan chan[2];
+  struct sockaddr_in client;
+  struct pollfd pfd[2];
+  struct timespec timeout;
+  double now, wait;
+  int listenport, serverport, haveclient = 0, i;
+
+  if (sscanf(spec, "%d %d", &listenport, &serverport) != 2) {
+    printf("EMU_PROXY should be \"<listen port> <server port>\"\n");
+    return EXIT_FAILURE;
+  }
+  lossprob = envfloat("EMU_PROXY_LOSS", 0.0);
+  corruptprob = envfloat("EMU_PROXY_CORRUPT", 0.0);
+  corruptdirection = (int)envfloat("EMU_PROXY_DIRECTION", 2);
+  proxyunit = envfloat("EMU_PROXY_UNIT", 1.0) / 1000.0;
+  TRACE = 0;
+  resetsim();
+  if (getenv("EMU_SCHEDULE") != NULL && *getenv("EMU_SCHEDULE") != '\0')
+    readschedule(getenv("EMU_SCHEDULE"));
+
+  for (i=0; i<2; i++) {
+    memset(&chan[i], 0, sizeof(chan[i]));
+    chan[i].from = i;
+    chan[i].buf = malloc((size_t)PROXY_SLOTS * PROXY_MTU);
+    if (chan[i].buf == 0) {
+      printf("memory allocation for proxy buffers failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pfd[A].fd = proxysocket(listenport, 0);   /* A side: the client talks to us here */
+  pfd[B].fd = proxysocket(serverport, 1);   /* B side: we talk to the server from here */
+  signal(SIGINT, proxysignal);
+  signal(SIGTERM, proxysignal);
+  clock_gettime(CLOCK_MONOTONIC, &proxyepoch);
+  printf("relaying 127.0.0.1:%d <-> 127.0.0.1:%d, loss %f, corruption %f, 1 time unit = %g ms\n",
+         listenport, serverport, lossprob, corruptprob, proxyunit * 1000.0);
+  fflush(stdout);
+
+  while (!proxystop) {
+    /* sleep until a datagram comes in or the next one in flight is due */
+    now = proxynow();
+    wait = 1.0 / proxyunit;
+    for (i=0; i<2; i++)
+      if (chan[i].count > 0 && chan[i].due[chan[i].head] - now < wait)
+        wait = chan[i].due[chan[i].head] - now;
+    if (wait < 0.0)
+      wait = 0.0;
+    wait *= proxyunit;
+    timeout.tv_sec = (time_t)wait;
+    timeout.tv_nsec = (long)((wait - timeout.tv_sec) * 1e9);
+    /* a direction whose queue is full is left in the socket buffer */
+    for (i=0; i<2; i++)
+      pfd[i].events = chan[i].count < PROXY_SLOTS ? POLLIN : 0;
+    if (ppoll(pfd, 2, &timeout, NULL) < 0 && errno != EINTR) {
+      printf("proxy: poll: %s\n", strerror(errno));
+      break;
+    }
+    now = proxynow();
+    /* e.g. the server port not open: an ICMP error on the B socket */
+    for (i=0; i<2; i++)
+      if (pfd[i].revents & POLLERR)
+        proxyerror(pfd[i].fd, &chan[!i]);
+    if (pfd[A].revents & POLLIN) {
+      proxyrecv(pfd[A].fd, &chan[A], &client, now);
+      haveclient = 1;
+    }
+    if (pfd[B].revents & POLLIN)
+      proxyrecv(pfd[B].fd, &chan[B], NULL, now);
+    proxysend(pfd[B].fd, &chan[A], NULL, now);         /* A->B towards the server */
+    if (haveclient)
+      proxysend(pfd[A].fd, &chan[B], &client, now);    /* B->A back to the client */
+  }
+
+  now = proxynow() * proxyunit;
+  printf("proxy ran for %.3f s\n", now);
+  proxystats("A->B", &chan[A], now);
+  proxystats("B->A", &chan[B], now);
+  if (nphases > 1)
+    printschedule(proxynow());
+  return EXIT_SUCCESS;
+}
+#else
+static int proxymain(const char *spec)
+{
+  (void)spec;
+  printf("the UDP proxy is only supported on Linux\n");
+  return EXIT_FAILURE;
+}
+#endif
+
+int main(void)
+{
+  registerbuiltins();
+  if (getenv("EMU_BENCH") != NULL)
+    return benchmain(getenv("EMU_BENCH"));
+  if (getenv("EMU_PROXY") != NULL)
+    return proxymain(getenv("EMU_PROXY"));
+  if (getenv("EMU_TUNE") != NULL)
+    return tunemain(getenv("EMU_TUNE"));
+  if (getenv("EMU_SWEEP") != NULL)
+    return sweepmain(getenv("EMU_SWEEP"));
+
+  init();
+  A_init();
+  B_init();
+  runsim();
+  report();
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -1,11 +1,8 @@
 extern int TRACE;
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+/* statistics updated by GBN: stat_add(STAT_WINDOW_FULL, 1) and so on,
+   see stats.h */
+#include "stats.h"
 
 #define   A    0
 #define   B    1
@@ -30,11 +27,42 @@ struct pkt {
 /* send to A or B (int), packet to send */
 extern void tolayer3(int, struct pkt);  
 
+/* packets kept in reference counted buffers, see pktbuf.h */
+#include "pktbuf.h"
+
+/* send to A or B (int), buffer holding the packet.  The medium takes its
+   own references to the buffer instead of copying the packet, so it must
+   not be changed afterwards; the caller keeps its reference */
+extern void tolayer3_buf(int, struct pktbuf *);
+
+/* send to A or B (int), buffers of the packets to send, number of packets */
+extern void tolayer3_bufbatch(int, struct pktbuf *[], int);
+
 /* deliver to A or B (int), data to deliver */
 extern void tolayer5(int, char[20]); 
 
+/* room left in the application buffer at A or B (int), in messages */
+extern int tolayer5_space(int);
+
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(int);
+
+/* current simulated time */
+extern float get_sim_time(void);
+
+/* extension events.  A module registers an event type once, giving a
+   name and a handler; the handler is called with the entity (A or B) and
+   payload of every event of that type as it falls due.  registerevent()
+   returns the type number to pass to scheduleevent(). */
+typedef void (*eventhandler)(int, void *);
+extern int registerevent(const char *, eventhandler);
+
+/* schedule an event: type, at A or B (int), delay from now, payload */
+extern void scheduleevent(int, int, double, void *);
+
+/* record a sample of protocol state at A or B (int), counter name, value
+   on the exported timeline; does nothing unless a timeline is being written */
+extern void tracecounter(int, const char *, double);               
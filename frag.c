@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "emulator.h"
+#include "sr.h"
+#include "frag.h"
+
+/* ******************************************************************
+   Message fragmentation and reassembly: see frag.h.
+**********************************************************************/
+
+/* a message's header, kept until the message is acknowledged since
+   A_outputv() packetizes from it in place */
+struct fraghdr {
+  unsigned char bytes[FRAG_HDRLEN];
+  void (*done)(void *);
+  void *cookie;
+};
+
+static void put32(unsigned char *p, uint32_t x)
+{
+  p[0] = (unsigned char)(x >> 24);
+  p[1] = (unsigned char)(x >> 16);
+  p[2] = (unsigned char)(x >> 8);
+  p[3] = (unsigned char)x;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* the time in the header's units; it wraps, latencies are differences */
+static uint32_t stamp(void)
+{
+  return (uint32_t)(get_sim_time() * 1000.0);
+}
+
+static void sent(void *p)
+{
+  struct fraghdr *h = p;
+
+  if (h->done != NULL)
+    h->done(h->cookie);
+  free(h);
+}
+
+int frag_send(const void *data, size_t len, void (*done)(void *), void *cookie)
+{
+  struct fraghdr *h;
+  struct msgvec iov[2];
+
+  if (len > UINT32_MAX)
+    return -1;
+  if ((h = malloc(sizeof(struct fraghdr))) == NULL) {
+    printf("memory allocation for message header failed.");
+    exit(EXIT_FAILURE);
+  }
+  put32(h->bytes, (uint32_t)len);
+  put32(h->bytes + 4, stamp());
+  h->done = done;
+  h->cookie = cookie;
+  iov[0].base = (const char *)h->bytes;
+  iov[0].len = FRAG_HDRLEN;
+  iov[1].base = data;
+  iov[1].len = len;
+  A_outputv(iov, 2, sent, h);
+  return 0;
+}
+
+void frag_rxinit(struct fragrx *rx, size_t maxmsg, int nbufs,
+                 void (*deliver)(void *, struct fragmsg *), void *cookie)
+{
+  int i;
+
+  memset(rx, 0, sizeof(*rx));
+  rx->maxmsg = maxmsg;
+  rx->nbufs = nbufs;
+  rx->msgs = malloc(nbufs * sizeof(struct fragmsg));
+  rx->storage = malloc(nbufs * maxmsg + 1);
+  if (rx->msgs == NULL || rx->storage == NULL) {
+    printf("memory allocation for reassembly buffers failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nbufs; i++) {
+    rx->msgs[i].data = rx->storage + i * maxmsg;
+    frag_release(rx, &rx->msgs[i]);
+  }
+  rx->deliver = deliver;
+  rx->cookie = cookie;
+}
+
+void frag_rxfree(struct fragrx *rx)
+{
+  free(rx->msgs);
+  free(rx->storage);
+}
+
+void frag_input(struct fragrx *rx, const char data[20])
+{
+  const unsigned char *p = (const unsigned char *)data;
+  struct fragmsg *m;
+  size_t off = 0, n, len;
+
+  if (rx->cur == NULL && rx->skip == 0) {
+    /* the first packet of a message */
+    len = get32(p);
+    rx->sent = get32(p + 4);
+    off = FRAG_HDRLEN;
+    if (len > rx->maxmsg || rx->free == NULL) {
+      rx->dropped++;
+      rx->skip = len;
+    }
+    else {
+      rx->cur = rx->free;
+      rx->free = rx->cur->next;
+      rx->cur->len = len;
+      rx->got = 0;
+    }
+  }
+
+  n = 20 - off;
+  if (rx->cur == NULL) {
+    rx->skip -= n < rx->skip ? n : rx->skip;
+    return;
+  }
+  m = rx->cur;
+  if (n > m->len - rx->got)
+    n = m->len - rx->got;   /* the rest is padding */
+  memcpy(m->data + rx->got, p + off, n);
+  rx->got += n;
+  if (rx->got == m->len) {
+    m->latency = (float)((uint32_t)(stamp() - rx->sent) / 1000.0);
+    stat_record(HIST_FRAG_LATENCY, m->latency);
+    rx->cur = NULL;
+    rx->deliver(rx->cookie, m);
+  }
+}
+
+int frag_space(const struct fragrx *rx)
+{
+  if (rx->free != NULL)
+    return INT_MAX;
+  /* no buffer for another message: just the rest of this one */
+  if (rx->cur != NULL)
+    return (int)((rx->cur->len - rx->got + 19) / 20);
+  return (int)((rx->skip + 19) / 20);
+}
+
+void frag_release(struct fragrx *rx, struct fragmsg *m)
+{
+  m->next = rx->free;
+  rx->free = m;
+}
+
+#ifdef FRAG_BENCH
+/* goodput and delivery latency against message size, over a network with
+   a one way delay of 5 time units and the given loss:
+     cc -O2 -DFRAG_BENCH -o fragbench frag.c sr.c stats.c pktbuf.c
+   The emulator is replaced by a small event loop; there are always two
+   messages queued at the sender.  Goodput is message bytes delivered per
+   time unit, and wire bytes the packet payload bytes sent (with
+   retransmissions) per message byte.  CPU is the real time taken per
+   message byte by fragmentation, SR and reassembly together. */
+#include <time.h>
+
+int TRACE = 0;
+
+#define DELAY 5.0
+#define NETQ 1024
+#define MAXMSG (1 << 20)
+#define MAXRUN 20000                   /* messages a run, at most */
+
+struct arrival {
+  float when;
+  struct pkt packet;
+};
+static struct arrival net[2][NETQ];   /* packets on their way to A and to B */
+static unsigned nethead[2], nettail[2];
+static float simnow, timerdue;
+static int timeron;
+static double loss;
+static long wirepackets;
+static struct fragrx rx;
+static char *source;
+static size_t msgsize;
+static long nmsg, nsubmitted, ndone, ndelivered, nbad;
+static float lat[MAXRUN];             /* each message's latency, for exact percentiles */
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  int to = AorB == A ? B : A;
+
+  if (AorB == A)
+    wirepackets++;
+  if ((double)rand() / RAND_MAX < loss || nettail[to] - nethead[to] == NETQ)
+    return;
+  net[to][nettail[to] % NETQ].when = simnow + DELAY;
+  net[to][nettail[to]++ % NETQ].packet = packet;
+}
+
+void tolayer3_buf(int AorB, struct pktbuf *buf)
+{
+  tolayer3(AorB, buf->pkt);
+}
+
+void tolayer5(int AorB, char data[20]) { (void)AorB; frag_input(&rx, data); }
+int tolayer5_space(int AorB) { (void)AorB; return frag_space(&rx); }
+void starttimer(int AorB, double increment) { (void)AorB; timeron = 1; timerdue = simnow + increment; }
+void stoptimer(int AorB) { (void)AorB; timeron = 0; }
+float get_sim_time(void) { return simnow; }
+void tracecounter(int AorB, const char *name, double value) { (void)AorB; (void)name; (void)value; }
+int registerevent(const char *name, eventhandler handler) { (void)name; (void)handler; return 0; }
+void scheduleevent(int type, int AorB, double delay, void *payload) { (void)type; (void)AorB; (void)delay; (void)payload; }
+
+static void submit(void);
+
+static void done(void *cookie)
+{
+  (void)cookie;
+  ndone++;
+  submit();
+}
+
+static void submit(void)
+{
+  if (nsubmitted < nmsg) {
+    nsubmitted++;
+    frag_send(source, msgsize, done, NULL);
+  }
+}
+
+static void deliver(void *cookie, struct fragmsg *m)
+{
+  (void)cookie;
+  if (m->len != msgsize || memcmp(m->data, source, msgsize) != 0)
+    nbad++;
+  if (ndelivered < MAXRUN)
+    lat[ndelivered] = m->latency;
+  ndelivered++;
+  frag_release(&rx, m);
+}
+
+/* run the next event; returns 0 if there is none */
+static int step(void)
+{
+  float ta = nethead[A] != nettail[A] ? net[A][nethead[A] % NETQ].when : -1;
+  float tb = nethead[B] != nettail[B] ? net[B][nethead[B] % NETQ].when : -1;
+
+  if (tb >= 0 && (ta < 0 || tb <= ta) && (!timeron || tb <= timerdue)) {
+    simnow = tb;
+    B_input(net[B][nethead[B]++ % NETQ].packet);
+  }
+  else if (ta >= 0 && (!timeron || ta <= timerdue)) {
+    simnow = ta;
+    A_input(net[A][nethead[A]++ % NETQ].packet);
+  }
+  else if (timeron) {
+    simnow = timerdue;
+    timeron = 0;
+    A_timerinterrupt();
+  }
+  else
+    return 0;
+  return 1;
+}
+
+static int floatcmp(const void *x, const void *y)
+{
+  float a = *(const float *)x, b = *(const float *)y;
+
+  return (a > b) - (a < b);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+  static const size_t sizes[] = {1, 12, 20, 100, 1000, 10000, 100000, 1000000};
+  double t0, cpu, mean;
+  size_t i;
+  long j, n;
+
+  loss = argc > 1 ? atof(argv[1]) : 0.0;
+  source = malloc(MAXMSG);
+  if (source == NULL)
+    return 1;
+  for (i = 0; i < MAXMSG; i++)
+    source[i] = (char)(i % 251);
+  frag_rxinit(&rx, MAXMSG, 4, deliver, NULL);
+  srand(1);
+
+  printf("loss %g, one way delay %g, window of 6 packets\n", loss, DELAY);
+  printf("%8s %7s %10s %10s %10s %10s %10s %10s\n", "size", "msgs", "goodput",
+         "wire/byte", "mean lat", "p50 lat", "p99 lat", "CPU ns/B");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    msgsize = sizes[i];
+    nmsg = 4000000 / msgsize;
+    nmsg = nmsg > MAXRUN ? MAXRUN : nmsg < 8 ? 8 : nmsg;
+    nsubmitted = ndone = ndelivered = nbad = wirepackets = 0;
+    nethead[A] = nettail[A] = nethead[B] = nettail[B] = 0;
+    simnow = 0.0;
+    timeron = 0;
+    A_init();
+    B_init();
+    stat_reset();
+
+    t0 = now();
+    submit();
+    submit();
+    while ((ndone < nmsg || ndelivered < nmsg) && step())
+      ;
+    cpu = (now() - t0) / ((double)nmsg * msgsize);
+
+    n = ndelivered < MAXRUN ? ndelivered : MAXRUN;
+    qsort(lat, n, sizeof(lat[0]), floatcmp);
+    for (j = 0, mean = 0.0; j < n; j++)
+      mean += lat[j] / n;
+    printf("%8lu %7ld %10.2f %10.2f %10.1f %10.1f %10.1f %10.1f\n", (unsigned long)msgsize, nmsg,
+           nmsg * msgsize / simnow, wirepackets * 20.0 / ((double)nmsg * msgsize), mean,
+           n > 0 ? lat[(int)(0.5 * (n - 1))] : 0.0, n > 0 ? lat[(int)(0.99 * (n - 1))] : 0.0, cpu);
+    if (ndone != nmsg || ndelivered != nmsg || nbad != 0 || rx.dropped != 0) {
+      printf("%ld sent, %ld delivered, %ld corrupt, %ld dropped of %ld\n",
+             ndone, ndelivered, nbad, rx.dropped, nmsg);
+      return 1;
+    }
+  }
+  frag_rxfree(&rx);
+  return 0;
+}
+#endif
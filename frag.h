@@ -0,0 +1,82 @@
+/* ******************************************************************
+   Fragmentation and reassembly of application messages of any size over
+   the selective repeat sender and receiver (sr.c).
+
+   frag_send() puts an 8 byte header in front of a message and hands
+   both to A_outputv(), which cuts them into 20 byte packets and pads the
+   last one, so every message starts a packet of its own:
+
+      +--------+--------+------------------------ - - - --+.........+
+      | length |  sent  |  message data                   | padding |
+      +--------+--------+------------------------ - - - --+.........+
+        32 bit   32 bit, thousandths of a time unit, both big endian
+
+   At the receiver every payload delivered to layer 5 goes to
+   frag_input(), which reads the header from the first packet of a
+   message, gathers the data into a reassembly buffer and, once it has
+   all of it, drops the padding and hands the message to the deliver
+   function along with its delivery latency (which is also recorded in
+   HIST_FRAG_LATENCY).  The receiver delivers packets in order, so only
+   one message is ever being reassembled.
+
+   Reassembly buffers are all allocated up front, a fixed number of a
+   fixed largest size.  A delivered message's buffer belongs to the
+   application until it is given back with frag_release(); while none is
+   free, frag_space() (for tolayer5_space()) holds back the packets of
+   the next message.  Messages larger than the buffers are dropped.
+**********************************************************************/
+#ifndef FRAG_H
+#define FRAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAG_HDRLEN 8
+
+/* a reassembled message */
+struct fragmsg {
+  char *data;
+  size_t len;
+  float latency;             /* time units from frag_send() to reassembly */
+  struct fragmsg *next;      /* next free buffer */
+};
+
+struct fragrx {
+  size_t maxmsg;             /* size of each buffer */
+  int nbufs;
+  struct fragmsg *msgs;      /* the buffers */
+  char *storage;             /* their data */
+  struct fragmsg *free;      /* buffers the application does not hold */
+  struct fragmsg *cur;       /* message being reassembled, or NULL */
+  size_t got;                /* bytes of it so far */
+  size_t skip;               /* bytes still to come of a message being dropped */
+  uint32_t sent;             /* the message's send time, from its header */
+  long dropped;              /* messages dropped */
+  void (*deliver)(void *, struct fragmsg *);
+  void *cookie;              /* for deliver */
+};
+
+/* send len bytes of data as one message on the selected connection (see
+   sr_select()).  The data is not copied until it is packetized, so it
+   must not change until done(cookie) is called, once it has all been
+   acknowledged or the connection is reset (see A_outputv(); done may be
+   NULL).  Returns -1 if len does not fit in the
+   header. */
+extern int frag_send(const void *data, size_t len, void (*done)(void *), void *cookie);
+
+/* set up a receiver with nbufs reassembly buffers of maxmsg bytes;
+   complete messages are passed to deliver(cookie, message) */
+extern void frag_rxinit(struct fragrx *, size_t maxmsg, int nbufs,
+                        void (*deliver)(void *, struct fragmsg *), void *cookie);
+extern void frag_rxfree(struct fragrx *);
+
+/* a payload delivered to layer 5 */
+extern void frag_input(struct fragrx *, const char data[20]);
+
+/* packets the receiver can take now */
+extern int frag_space(const struct fragrx *);
+
+/* give a delivered message's buffer back */
+extern void frag_release(struct fragrx *, struct fragmsg *);
+
+#endif
@@ -22,12 +22,21 @@
    - added GBN implementation
 **********************************************************************/
 
+/* RTT and WINDOWSIZE can be set with -D, to try other values */
+#ifndef RTT
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
+#define SEQSPACE (WINDOWSIZE + 1) /* the min sequence space for GBN must be at least windowsize + 1 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+const char protocol_name[] = "gbn";
+const int protocol_window = WINDOWSIZE;
+const double protocol_rtt = RTT;
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
@@ -57,11 +66,41 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
+/* the window buffer is split in two: the headers, which ACK processing
+   reads, and the packets, which are only needed when they are resent.
+   Keeping them apart means ACK processing never touches packet bytes.
+   The packets are kept in buffers shared with the medium (see pktbuf.h),
+   so neither sending nor resending one copies it. */
+struct pkthdr {
+  int seqnum;
+};
+
+static struct pkthdr buffer[WINDOWSIZE];  /* headers of packets waiting for ACK */
+static struct pktbuf *pbuf[WINDOWSIZE];   /* the packets, at the same index */
 static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
 static int windowcount;                /* the number of packets currently awaiting an ACK */
 static int A_nextseqnum;               /* the next sequence number to be used by the sender */
 
+/* Retransmission timer.  Instead of stopping and restarting the emulator
+   timer on every ACK, the sender keeps a logical deadline for the oldest
+   unacknowledged packet and just moves it.  The deadline only ever moves
+   later, so a running timer never needs cancelling: when it goes off early
+   it is re-armed for the deadline.  The emulator timer is only started
+   when none is running. */
+#define TIMER_SLACK 0.001       /* a timer this close to the deadline counts as on time */
+
+static float A_deadline;        /* when the oldest unACKed packet is due for retransmission */
+static bool A_timerrunning;     /* the emulator timer is armed */
+
+/* make sure a timer will go off no later than A_deadline */
+static void ArmTimer(void)
+{
+  if (!A_timerrunning) {
+    starttimer(A, A_deadline - get_sim_time());
+    A_timerrunning = true;
+  }
+}
+
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 void A_output(struct msg message)
 {
@@ -83,17 +122,21 @@ void A_output(struct msg message)
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
     windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
+    buffer[windowlast].seqnum = sendpkt.seqnum;
+    pbuf[windowlast] = pb_alloc(&sendpkt);
     windowcount++;
+    tracecounter(A, "window", windowcount);
 
     /* send out packet */
     if (TRACE > 0)
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+    tolayer3_buf (A, pbuf[windowlast]);
 
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+    /* set the deadline and start timer if first packet in window */
+    if (windowcount == 1) {
+      A_deadline = get_sim_time() + RTT;
+      ArmTimer();
+    }
 
     /* get next sequence number, wrap back to 0 */
     A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
@@ -102,7 +145,7 @@ void A_output(struct msg message)
   else {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    stat_add(STAT_WINDOW_FULL, 1);
   }
 }
 
@@ -119,7 +162,7 @@ void A_input(struct pkt packet)
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
+    stat_add(STAT_ACKS_RECEIVED, 1);
 
     /* check if new ACK or duplicate */
     if (windowcount != 0) {
@@ -132,7 +175,7 @@ void A_input(struct pkt packet)
             /* packet is a new ACK */
             if (TRACE > 0)
               printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
+            stat_add(STAT_NEW_ACKS, 1);
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
             if (packet.acknum >= seqfirst)
@@ -140,17 +183,21 @@ void A_input(struct pkt packet)
             else
               ackcount = SEQSPACE - seqfirst + packet.acknum;
 
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
-
             /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
+            for (i=0; i<ackcount; i++) {
+              pb_put(pbuf[(windowfirst + i) % WINDOWSIZE]);
               windowcount--;
+            }
+
+	    /* slide window by the number of packets ACKed */
+            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            tracecounter(A, "window", windowcount);
 
-	    /* start timer again if there are still more unacked packets in window */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
+	    /* give the new oldest packet a full RTT; the running timer catches up lazily */
+            if (windowcount > 0) {
+              A_deadline = get_sim_time() + RTT;
+              ArmTimer();
+            }
 
           }
         }
@@ -166,20 +213,35 @@ void A_input(struct pkt packet)
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
-  int i;
+  struct pktbuf *resend[WINDOWSIZE];
+  int i, index;
+
+  A_timerrunning = false;
+  /* nothing outstanding: let the timer lapse */
+  if (windowcount == 0)
+    return;
+  /* the deadline moved on since the timer was armed: re-arm for it */
+  if (get_sim_time() + TIMER_SLACK < A_deadline) {
+    ArmTimer();
+    return;
+  }
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
+  /* go back N: collect the whole window and hand it to layer 3 as one burst */
   for(i=0; i<windowcount; i++) {
+    index = (windowfirst+i) % WINDOWSIZE;
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", buffer[index].seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
-    if (i==0) starttimer(A,RTT);
+    resend[i] = pbuf[index];
   }
+  tolayer3_bufbatch(A, resend, windowcount);
+  stat_add(STAT_PACKETS_RESENT, windowcount);
+  A_deadline = get_sim_time() + RTT;
+  ArmTimer();
 }
 
 
@@ -188,7 +250,12 @@ void A_timerinterrupt(void)
 /* entity A routines are called. You can use it to do any initialization */
 void A_init(void)
 {
-  /* initialise A's window, buffer and sequence number */
+  int i;
+
+  /* let go of anything left in the window, then initialise A's window,
+     buffer and sequence number */
+  for (i=0; i<windowcount; i++)
+    pb_put(pbuf[(windowfirst + i) % WINDOWSIZE]);
   A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
   windowfirst = 0;
   windowlast = -1;   /* windowlast is where the last packet sent is stored.
@@ -196,6 +263,7 @@ void A_init(void)
 		     so initially this is set to -1
 		   */
   windowcount = 0;
+  A_timerrunning = false;
 }
 
 
@@ -212,11 +280,11 @@ void B_input(struct pkt packet)
   struct pkt sendpkt;
   int i;
 
-  /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  /* if not corrupted, received packet is in order and the application has room for it */
+  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) && (tolayer5_space(B) > 0) ) {
     if (TRACE > 0)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
+    stat_add(STAT_PACKETS_RECEIVED, 1);
 
     /* deliver to receiving application */
     tolayer5(B, packet.payload);
@@ -228,7 +296,7 @@ void B_input(struct pkt packet)
     expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
   }
   else {
-    /* packet is corrupted or out of order resend last ACK */
+    /* packet is corrupted, out of order or cannot be taken yet; resend last ACK */
     if (TRACE > 0)
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
     if (expectedseqnum == 0)
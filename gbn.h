@@ -5,6 +5,11 @@ extern void B_input(struct pkt);
 extern void A_output(struct msg);
 extern void A_timerinterrupt(void);
 
+/* which protocol this is, its window and timeout, for labelling results */
+extern const char protocol_name[];
+extern const int protocol_window;
+extern const double protocol_rtt;
+
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
 extern void B_output(struct msg);
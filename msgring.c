@@ -0,0 +1,414 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "sr.h"
+#include "msgring.h"
+
+/* ******************************************************************
+   Submission and completion rings: see msgring.h.
+
+   Ring indices run freely and wrap at 2^32; an entry's place is its
+   index masked by the (power of two) size, and a queue holds tail - head
+   entries.
+**********************************************************************/
+
+#define CACHELINE 64
+
+#ifdef __GNUC__
+#define LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD(p)        (*(p))
+#define STORE(p, v)    (*(p) = (v))
+#endif
+
+/* a message in flight: what its ACK completion needs */
+struct mrop {
+  struct msgring *ring;
+  void *user_data;
+  struct mrop *next;         /* next free one */
+};
+
+/* The pads keep the three groups of fields at least a cache line apart.
+   Each side reads only its own copies of the other side's indices (the
+   ...seen fields) until they say it has to look again. */
+struct msgring {
+  /* fixed when the ring is made */
+  unsigned mask;             /* entries - 1 */
+  struct mrsqe *sq;
+  struct mrcqe *cq;
+  struct mrop *ops;
+  char pad0[CACHELINE];
+
+  /* written by the application */
+  unsigned sqtail;           /* where the next submission goes */
+  unsigned cqhead;           /* the next completion to reap */
+  unsigned sqheadseen;       /* sqhead when last loaded */
+  unsigned cqtailseen;       /* cqtail when last loaded */
+  char pad1[CACHELINE];
+
+  /* written by the engine */
+  unsigned sqhead;           /* the next submission to take */
+  unsigned cqtail;           /* where the next completion goes */
+  unsigned sqtailseen;
+  unsigned cqheadseen;
+  unsigned inflight;         /* messages taken and not yet ACKed */
+  struct mrop *freeops;
+  char pad2[CACHELINE];
+};
+
+struct msgring *mr_create(unsigned entries)
+{
+  struct msgring *ring = calloc(1, sizeof(struct msgring));
+  unsigned size = 1, i;
+
+  while (size < entries)
+    size *= 2;
+  if (ring == NULL ||
+      (ring->sq = malloc(size * sizeof(struct mrsqe))) == NULL ||
+      (ring->cq = malloc(size * sizeof(struct mrcqe))) == NULL ||
+      (ring->ops = malloc(size * sizeof(struct mrop))) == NULL) {
+    printf("memory allocation for message ring failed.");
+    exit(EXIT_FAILURE);
+  }
+  ring->mask = size - 1;
+  for (i = 0; i < size; i++) {
+    ring->ops[i].ring = ring;
+    ring->ops[i].next = i + 1 < size ? &ring->ops[i + 1] : NULL;
+  }
+  ring->freeops = ring->ops;
+  return ring;
+}
+
+void mr_destroy(struct msgring *ring)
+{
+  free(ring->sq);
+  free(ring->cq);
+  free(ring->ops);
+  free(ring);
+}
+
+/********* application side ************/
+
+int mr_submit(struct msgring *ring, const struct mrsqe *sqes, int n)
+{
+  unsigned tail = ring->sqtail, size = ring->mask + 1;
+  int i;
+
+  if (n <= 0)
+    return 0;
+  if (tail - ring->sqheadseen + (unsigned)n > size)
+    ring->sqheadseen = LOAD(&ring->sqhead);
+  if ((unsigned)n > size - (tail - ring->sqheadseen))
+    n = (int)(size - (tail - ring->sqheadseen));
+  for (i = 0; i < n; i++)
+    ring->sq[(tail + i) & ring->mask] = sqes[i];
+  if (n > 0)
+    STORE(&ring->sqtail, tail + n);
+  return n;
+}
+
+int mr_reap(struct msgring *ring, struct mrcqe *cqes, int max)
+{
+  unsigned head = ring->cqhead;
+  int n = 0;
+
+  if (head == ring->cqtailseen)
+    ring->cqtailseen = LOAD(&ring->cqtail);
+  while (n < max && head != ring->cqtailseen)
+    cqes[n++] = ring->cq[head++ & ring->mask];
+  if (n > 0)
+    STORE(&ring->cqhead, head);
+  return n;
+}
+
+/********* engine side ************/
+
+/* completion queue entries neither used nor held for a message in flight */
+static unsigned room(struct msgring *ring)
+{
+  unsigned size = ring->mask + 1;
+
+  if (ring->cqtail - ring->cqheadseen + ring->inflight >= size)
+    ring->cqheadseen = LOAD(&ring->cqhead);
+  return size - (ring->cqtail - ring->cqheadseen) - ring->inflight;
+}
+
+static void post(struct msgring *ring, void *user_data, int res, const char *data)
+{
+  struct mrcqe *cqe = &ring->cq[ring->cqtail & ring->mask];
+
+  cqe->user_data = user_data;
+  cqe->res = res;
+  if (data != NULL)
+    memcpy(cqe->data, data, 20);
+  STORE(&ring->cqtail, ring->cqtail + 1);
+}
+
+/* A_outputv() completion: the entry held for it takes the completion */
+static void acked(void *cookie)
+{
+  struct mrop *op = cookie;
+  struct msgring *ring = op->ring;
+
+  ring->inflight--;
+  post(ring, op->user_data, sr_cancelled() ? MR_CANCELLED : MR_ACKED, NULL);
+  op->next = ring->freeops;
+  ring->freeops = op;
+}
+
+int mr_process(struct msgring *ring)
+{
+  unsigned head = ring->sqhead;
+  struct mrsqe *sqe;
+  struct mrop *op;
+  int n = 0;
+
+  if (head == ring->sqtailseen)
+    ring->sqtailseen = LOAD(&ring->sqtail);
+  while (head != ring->sqtailseen && room(ring) > 0) {
+    sqe = &ring->sq[head & ring->mask];
+    op = ring->freeops;      /* one per entry, so never short */
+    ring->freeops = op->next;
+    op->user_data = sqe->user_data;
+    ring->inflight++;
+    A_outputv(&sqe->buf, 1, acked, op);
+    head++;
+    n++;
+  }
+  if (n > 0)
+    STORE(&ring->sqhead, head);
+  return n;
+}
+
+int mr_deliver(struct msgring *ring, const char data[20])
+{
+  if (room(ring) == 0)
+    return -1;
+  post(ring, NULL, MR_DELIVERED, data);
+  return 0;
+}
+
+int mr_space(struct msgring *ring)
+{
+  return (int)room(ring);
+}
+
+#ifdef MSGRING_BENCH
+/* message rate and submission to ACK completion latency, with the
+   application on a thread of its own talking to the engine through the
+   rings, against the application calling A_outputv() directly:
+     cc -O2 -DMSGRING_BENCH -o msgring msgring.c sr.c stats.c pktbuf.c -lpthread
+   The emulator is replaced by a lossless loopback network run by the
+   engine, with a clock that only moves while a timer is waiting.  Both
+   threads poll, yielding when they find nothing to do. */
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+int TRACE = 0;
+
+#define NETQ 256
+static struct pkt net[2][NETQ];      /* packets on their way to A and to B */
+static unsigned nethead[2], nettail[2];
+static float clocknow, timerdue;
+static int timeron;
+static struct msgring *aring;        /* sender's rings, NULL for direct calls */
+static struct msgring *bring;        /* receiver's, for deliveries */
+static long expect;                  /* next message due at B */
+static int stop;
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  int to = AorB == A ? B : A;
+
+  if (nettail[to] - nethead[to] < NETQ)
+    net[to][nettail[to]++ % NETQ] = packet;
+}
+
+void tolayer3_buf(int AorB, struct pktbuf *buf)
+{
+  tolayer3(AorB, buf->pkt);
+}
+
+void tolayer5(int AorB, char data[20])
+{
+  (void)AorB;
+  if (bring != NULL)
+    mr_deliver(bring, data);
+  else if (atol(data) == expect)
+    expect++;
+}
+
+int tolayer5_space(int AorB) { (void)AorB; return bring != NULL ? mr_space(bring) : NETQ; }
+void starttimer(int AorB, double increment) { (void)AorB; timeron = 1; timerdue = clocknow + increment; }
+void stoptimer(int AorB) { (void)AorB; timeron = 0; }
+float get_sim_time(void) { return clocknow; }
+void tracecounter(int AorB, const char *name, double value) { (void)AorB; (void)name; (void)value; }
+int registerevent(const char *name, eventhandler handler) { (void)name; (void)handler; return 0; }
+void scheduleevent(int type, int AorB, double delay, void *payload) { (void)type; (void)AorB; (void)delay; (void)payload; }
+
+/* carry every packet on the network to its destination; returns how many */
+static int netrun(void)
+{
+  int n = 0;
+
+  while (nethead[B] != nettail[B] || nethead[A] != nettail[A]) {
+    if (nethead[B] != nettail[B])
+      B_input(net[B][nethead[B]++ % NETQ]);
+    if (nethead[A] != nettail[A])
+      A_input(net[A][nethead[A]++ % NETQ]);
+    n++;
+  }
+  return n;
+}
+
+/* nothing moved: let time pass for a timer that is waiting */
+static void idle(void)
+{
+  if (timeron && ++clocknow >= timerdue) {
+    timeron = 0;
+    A_timerinterrupt();
+  }
+  sched_yield();
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long nmsg;
+static char (*bufs)[20];             /* message payloads, by id % NBUFS */
+#define NBUFS 4096
+static double *tsub, *lat;           /* submission time and latency, by id */
+static long nacked;
+
+static void directdone(void *cookie)
+{
+  long id = (long)cookie;
+
+  lat[id] = now() - tsub[id];
+  nacked++;
+}
+
+static void *engine(void *arg)
+{
+  (void)arg;
+  while (!LOAD(&stop))
+    if (mr_process(aring) + netrun() == 0)
+      idle();
+  return NULL;
+}
+
+static int cmpdouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, double elapsed)
+{
+  qsort(lat, nmsg, sizeof(double), cmpdouble);
+  printf("%-8s %10.0f %10.0f %10.0f %10.0f %10.0f\n", name, nmsg / elapsed * 1e9,
+         lat[nmsg / 2], lat[nmsg * 99 / 100], lat[nmsg * 999 / 1000], lat[nmsg - 1]);
+}
+
+static void fill(long id)
+{
+  char text[24];
+
+  snprintf(text, sizeof(text), "%ld", id);
+  memcpy(bufs[id % NBUFS], text, 20);
+}
+
+int main(int argc, char **argv)
+{
+  struct mrsqe batch[32];
+  struct mrcqe cqes[64];
+  struct msgvec v;
+  pthread_t thread;
+  long id, next, got;
+  unsigned entries = argc > 2 ? (unsigned)atol(argv[2]) : 256;
+  double t0;
+  int i, k, n;
+
+  nmsg = argc > 1 ? atol(argv[1]) : 1000000;
+  bufs = malloc(NBUFS * sizeof(*bufs));
+  tsub = malloc(nmsg * sizeof(double));
+  lat = malloc(nmsg * sizeof(double));
+  if (bufs == NULL || tsub == NULL || lat == NULL || entries * 2 > NBUFS)
+    return 1;
+  printf("%ld 20 byte messages, rings of %u entries\n", nmsg, entries);
+  printf("%-8s %10s %10s %10s %10s %10s\n", "", "msgs/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+
+  /* direct: the application is the engine's thread */
+  A_init();
+  B_init();
+  t0 = now();
+  for (id = 0; id < nmsg; id++) {
+    fill(id);
+    v.base = bufs[id % NBUFS];
+    v.len = 20;
+    tsub[id] = now();
+    A_outputv(&v, 1, directdone, (void *)id);
+    netrun();
+  }
+  report("direct", now() - t0);
+  if (nacked != nmsg || expect != nmsg) {
+    printf("direct: %ld ACKed, %ld delivered in order of %ld\n", nacked, expect, nmsg);
+    return 1;
+  }
+
+  /* rings: the application on this thread, the engine on another */
+  A_init();
+  B_init();
+  aring = mr_create(entries);
+  bring = mr_create(entries);
+  expect = nacked = 0;
+  if (pthread_create(&thread, NULL, engine, NULL) != 0)
+    return 1;
+  t0 = now();
+  for (next = 0; nacked < nmsg || expect < nmsg; ) {
+    /* submit while there are buffers free: a buffer is the application's
+       again once its message is ACKed */
+    for (k = 0; k < 32 && next + k < nmsg && next + k - nacked < NBUFS; k++) {
+      fill(next + k);
+      batch[k].buf.base = bufs[(next + k) % NBUFS];
+      batch[k].buf.len = 20;
+      batch[k].user_data = (void *)(next + k);
+    }
+    for (i = 0; i < k; i++)
+      tsub[next + i] = now();
+    n = mr_submit(aring, batch, k);
+    next += n;
+    got = mr_reap(aring, cqes, 64);
+    for (i = 0; i < got; i++) {
+      id = (long)cqes[i].user_data;
+      lat[id] = now() - tsub[id];
+      nacked++;
+    }
+    k = mr_reap(bring, cqes, 64);
+    for (i = 0; i < k; i++)
+      if (atol(cqes[i].data) == expect)
+        expect++;
+      else {
+        printf("rings: message %ld delivered out of order\n", expect);
+        return 1;
+      }
+    if (n == 0 && got == 0 && k == 0)
+      sched_yield();
+  }
+  report("rings", now() - t0);
+  STORE(&stop, 1);
+  pthread_join(thread, NULL);
+  mr_destroy(aring);
+  mr_destroy(bring);
+  return 0;
+}
+#endif
@@ -0,0 +1,92 @@
+/* ******************************************************************
+   Submission and completion rings between an application thread and the
+   selective repeat engine (sr.c).
+
+   The application and the protocol engine share a pair of single
+   producer, single consumer rings, after the manner of io_uring: the
+   application pushes message descriptors onto the submission queue and
+   the engine, running on a thread of its own, takes them off and sends
+   them with A_outputv(); the engine pushes completions onto the
+   completion queue, one when a message has been acknowledged and one for
+   every packet delivered, and the application reaps them.  The sending
+   and the receiving application have a ring each: A's carries
+   submissions and their ACKs, B's deliveries.
+
+   Deliveries are a byte stream, not messages: A_outputv() cuts a message
+   into 20 byte packets and pads the last with zeros, and nothing on the
+   wire marks where a message ends, so a message longer than 20 bytes
+   arrives as several MR_DELIVERED completions that look like any others.
+   An application that needs message boundaries frames its messages
+   itself, as frag.c does with a length header.
+
+      application                                   engine
+        mr_submit() --> [ sq: base,len,user_data ] --> mr_process()
+        mr_reap()   <-- [ cq: user_data,res,data ] <-- ACK / mr_deliver()
+
+   Each queue has one writer per index, so neither side takes a lock; an
+   index is published with a release store after the entries it covers
+   are written and read with an acquire load.  The indices written by the
+   application, those written by the engine and the fixed fields are on
+   separate cache lines, and each side keeps a copy of the other side's
+   index and only reloads it when the copy says the queue is full (or
+   empty), so in steady state a batch of entries costs one cache line
+   transfer each way.
+
+   The engine never has more messages in flight than the completion queue
+   has room for, so an ACK always finds a place for its completion and
+   the completion queue cannot overflow; submissions beyond that wait in
+   the submission queue.  (A ring used for both would deadlock once the
+   messages in flight held all its room and could not be delivered.)
+   A message's buffer is the application's until
+   its MR_ACKED (or MR_CANCELLED) completion has been reaped.
+
+   Without GCC-style atomic builtins the rings may only be used from a
+   single thread.
+**********************************************************************/
+#ifndef MSGRING_H
+#define MSGRING_H
+
+/* include after emulator.h and sr.h */
+
+/* a submission: a message to send */
+struct mrsqe {
+  struct msgvec buf;         /* the bytes to send */
+  void *user_data;           /* handed back in its completion */
+};
+
+enum mrres {
+  MR_ACKED,                  /* every byte of user_data's message has been ACKed */
+  MR_DELIVERED,              /* a packet's data has been delivered to the receiving application */
+  MR_CANCELLED               /* the connection was reset before user_data's message was ACKed */
+};
+
+/* a completion */
+struct mrcqe {
+  void *user_data;           /* MR_ACKED, MR_CANCELLED: the submission's */
+  int res;                   /* enum mrres */
+  char data[20];             /* MR_DELIVERED: the next 20 bytes of the stream */
+};
+
+struct msgring;
+
+/* rings of entries submissions and completions (rounded up to a power
+   of two) */
+extern struct msgring *mr_create(unsigned entries);
+extern void mr_destroy(struct msgring *);
+
+/* application side.  mr_submit() queues up to n messages and returns
+   how many fit; mr_reap() takes up to max completions into cqes and
+   returns how many there were.  Neither waits. */
+extern int mr_submit(struct msgring *, const struct mrsqe *sqes, int n);
+extern int mr_reap(struct msgring *, struct mrcqe *cqes, int max);
+
+/* engine side.  mr_process() sends the queued submissions that may be
+   in flight on the selected connection (see sr_select()) and returns how
+   many it took.  Layer 5 delivery goes through mr_deliver(), which
+   returns -1 if there is no room for the completion; mr_space() is the
+   number of deliveries there is room for, for tolayer5_space(). */
+extern int mr_process(struct msgring *);
+extern int mr_deliver(struct msgring *, const char data[20]);
+extern int mr_space(struct msgring *);
+
+#endif
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+
+/* ******************************************************************
+   Reference counted packet buffers: see pktbuf.h.
+**********************************************************************/
+
+static struct pktbuf *freebufs;   /* buffers nobody holds */
+long pb_live, pb_peak;
+
+struct pktbuf *pb_alloc(const struct pkt *packet)
+{
+  struct pktbuf *b = freebufs;
+
+  if (b != NULL)
+    freebufs = b->next;
+  else if ((b = malloc(sizeof(struct pktbuf))) == NULL) {
+    printf("memory allocation for packet buffer failed.");
+    exit(EXIT_FAILURE);
+  }
+  b->refs = 1;
+  b->pkt = *packet;
+  if (++pb_live > pb_peak)
+    pb_peak = pb_live;
+  return b;
+}
+
+struct pktbuf *pb_get(struct pktbuf *b)
+{
+  b->refs++;
+  return b;
+}
+
+void pb_put(struct pktbuf *b)
+{
+  if (--b->refs > 0)
+    return;
+  b->next = freebufs;
+  freebufs = b;
+  pb_live--;
+}
+
+struct pktbuf *pb_writable(struct pktbuf *b)
+{
+  struct pktbuf *copy;
+
+  if (b->refs == 1)
+    return b;
+  copy = pb_alloc(&b->pkt);
+  pb_put(b);
+  return copy;
+}
@@ -0,0 +1,44 @@
+/* ******************************************************************
+   Reference counted packet buffers.
+
+   A packet that is sent more than once, or is in the medium several
+   times over (a retransmission while the original is still in flight),
+   need not be copied each time: the sender's window keeps the packet in
+   a buffer, and every copy the medium carries is just another reference
+   to it.  A buffer is immutable once it has more than one holder.  The
+   medium's corruption of a packet is copy on write: pb_writable() gives
+   the holder a private copy if anyone else still holds the original.
+   Whatever the number of retransmissions, a packet in flight costs one
+   buffer.
+
+   Buffers come from a free list and go back to it when the last
+   reference is dropped.  The counts are not atomic: buffers belong to
+   the thread that runs the emulator and the protocol.
+**********************************************************************/
+#ifndef PKTBUF_H
+#define PKTBUF_H
+
+struct pktbuf {
+  int refs;                  /* holders of the buffer */
+  struct pkt pkt;            /* read only while refs > 1 */
+  struct pktbuf *next;       /* next on the free list */
+};
+
+/* a buffer holding a copy of packet, with one reference */
+extern struct pktbuf *pb_alloc(const struct pkt *packet);
+
+/* take another reference to b; returns b */
+extern struct pktbuf *pb_get(struct pktbuf *b);
+
+/* drop a reference; the buffer is freed with the last one */
+extern void pb_put(struct pktbuf *b);
+
+/* a buffer with the contents of b that the caller alone holds, in place
+   of the caller's reference to b: b itself if there is no other holder,
+   otherwise a copy */
+extern struct pktbuf *pb_writable(struct pktbuf *b);
+
+/* buffers currently held, and the most ever held at once */
+extern long pb_live, pb_peak;
+
+#endif
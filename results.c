@@ -0,0 +1,713 @@
+#define _POSIX_C_SOURCE 200809L   /* pread() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "results.h"
+
+/* ******************************************************************
+   Columnar result store: see results.h.
+**********************************************************************/
+
+#define RS_MAGIC   "RSTORE1\n"
+#define RS_ORDER   0x01020304u     /* reads back differently on the other byte order */
+#define BLK_MAGIC  0x4b4c4252u     /* "RBLK" */
+
+struct rsheader {
+  char magic[8];
+  uint32_t ncols;
+  uint32_t order;
+  /* then ncols struct rscol */
+};
+
+struct rsblockhdr {
+  uint32_t magic;
+  uint32_t nrows;
+  uint64_t size;                   /* of the whole block, header included */
+  /* then ncols min values, ncols max values and the columns */
+};
+
+struct rswriter {
+  int fd;
+  int ncols;
+  struct rscol cols[RS_MAXCOLS];
+  int nrows;                       /* rows waiting to be written */
+  char *col[RS_MAXCOLS];           /* their values, column by column */
+  char *block;                     /* a block being put together */
+  int error;
+};
+
+static size_t align8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+
+static uint32_t typewidth(uint32_t type)
+{
+  return type == RS_I32 ? 4 : 8;
+}
+
+static size_t blocksize(int ncols, const struct rscol *cols, int nrows)
+{
+  size_t size = sizeof(struct rsblockhdr) + 2 * ncols * sizeof(union rsval);
+  int c;
+
+  for (c = 0; c < ncols; c++)
+    size += align8((size_t)cols[c].width * nrows);
+  return size;
+}
+
+/* -1, 0 or 1 as a is less than, equal to or greater than b */
+static int compare(uint32_t type, const union rsval *a, const union rsval *b)
+{
+  switch (type) {
+  case RS_I32:
+    return (a->i32 > b->i32) - (a->i32 < b->i32);
+  case RS_I64:
+    return (a->i64 > b->i64) - (a->i64 < b->i64);
+  case RS_F64:
+    return (a->f64 > b->f64) - (a->f64 < b->f64);
+  default:
+    return memcmp(a->str8, b->str8, 8);
+  }
+}
+
+static union rsval getval(uint32_t type, const char *col, int i)
+{
+  union rsval v;
+
+  memset(&v, 0, sizeof(v));
+  memcpy(&v, col + (size_t)i * typewidth(type), typewidth(type));
+  return v;
+}
+
+/********* writing ************/
+
+static int writeall(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, p, len)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/* cut off a block left incomplete by an earlier writer, so that the
+   blocks appended after it can be found */
+static int truncate_tail(struct rswriter *w, size_t size)
+{
+  struct rsblockhdr bh;
+  size_t offset = sizeof(struct rsheader) + w->ncols * sizeof(struct rscol);
+
+  while (pread(w->fd, &bh, sizeof(bh), (off_t)offset) == (ssize_t)sizeof(bh) &&
+         bh.magic == BLK_MAGIC && bh.nrows > 0 && bh.nrows <= RS_BLOCKROWS &&
+         bh.size == blocksize(w->ncols, w->cols, (int)bh.nrows) && bh.size <= size - offset)
+    offset += bh.size;
+  return offset < size ? ftruncate(w->fd, (off_t)offset) : 0;
+}
+
+struct rswriter *rs_create(const char *file, const struct rscol *cols, int ncols)
+{
+  struct rswriter *w;
+  struct rsheader h;
+  struct rscol disk[RS_MAXCOLS];
+  struct stat st;
+  int c;
+
+  if (ncols < 1 || ncols > RS_MAXCOLS) {
+    printf("result store %s: %d columns, at most %d allowed\n", file, ncols, RS_MAXCOLS);
+    return NULL;
+  }
+  if ((w = calloc(1, sizeof(struct rswriter))) == NULL ||
+      (w->block = malloc(blocksize(ncols, cols, RS_BLOCKROWS) + 8 * RS_BLOCKROWS * ncols)) == NULL) {
+    printf("memory allocation for result store failed.");
+    exit(EXIT_FAILURE);
+  }
+  w->ncols = ncols;
+  for (c = 0; c < ncols; c++) {
+    memset(&w->cols[c], 0, sizeof(struct rscol));
+    snprintf(w->cols[c].name, RS_NAMELEN, "%s", cols[c].name);
+    w->cols[c].type = cols[c].type;
+    w->cols[c].width = typewidth(cols[c].type);
+    if ((w->col[c] = malloc((size_t)w->cols[c].width * RS_BLOCKROWS)) == NULL) {
+      printf("memory allocation for result store failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((w->fd = open(file, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0 || fstat(w->fd, &st) < 0) {
+    printf("result store %s: %s\n", file, strerror(errno));
+    goto fail;
+  }
+  if (st.st_size == 0) {
+    memcpy(h.magic, RS_MAGIC, 8);
+    h.ncols = (uint32_t)ncols;
+    h.order = RS_ORDER;
+    if (writeall(w->fd, &h, sizeof(h)) < 0 || writeall(w->fd, w->cols, ncols * sizeof(struct rscol)) < 0) {
+      printf("result store %s: %s\n", file, strerror(errno));
+      goto fail;
+    }
+  }
+  else if (pread(w->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, RS_MAGIC, 8) != 0 ||
+           h.order != RS_ORDER || h.ncols != (uint32_t)ncols ||
+           pread(w->fd, disk, ncols * sizeof(struct rscol), sizeof(h)) != (ssize_t)(ncols * sizeof(struct rscol)) ||
+           memcmp(disk, w->cols, ncols * sizeof(struct rscol)) != 0) {
+    printf("result store %s: not a store with these columns (written by another version?)\n", file);
+    goto fail;
+  }
+  else if (truncate_tail(w, (size_t)st.st_size) < 0) {
+    printf("result store %s: %s\n", file, strerror(errno));
+    goto fail;
+  }
+  return w;
+
+fail:
+  if (w->fd >= 0)
+    close(w->fd);
+  for (c = 0; c < ncols; c++)
+    free(w->col[c]);
+  free(w->block);
+  free(w);
+  return NULL;
+}
+
+/* write the rows held as one block, with a single write() */
+static void flush(struct rswriter *w)
+{
+  struct rsblockhdr *bh = (struct rsblockhdr *)w->block;
+  union rsval *min = (union rsval *)(bh + 1), *max = min + w->ncols, v;
+  char *p = (char *)(max + w->ncols);
+  size_t len;
+  int c, i;
+
+  if (w->nrows == 0)
+    return;
+  bh->magic = BLK_MAGIC;
+  bh->nrows = (uint32_t)w->nrows;
+  bh->size = blocksize(w->ncols, w->cols, w->nrows);
+  for (c = 0; c < w->ncols; c++) {
+    min[c] = max[c] = getval(w->cols[c].type, w->col[c], 0);
+    for (i = 1; i < w->nrows; i++) {
+      v = getval(w->cols[c].type, w->col[c], i);
+      if (compare(w->cols[c].type, &v, &min[c]) < 0)
+        min[c] = v;
+      if (compare(w->cols[c].type, &v, &max[c]) > 0)
+        max[c] = v;
+    }
+    len = (size_t)w->cols[c].width * w->nrows;
+    memcpy(p, w->col[c], len);
+    memset(p + len, 0, align8(len) - len);
+    p += align8(len);
+  }
+  if (writeall(w->fd, w->block, (size_t)bh->size) < 0)
+    w->error = 1;
+  w->nrows = 0;
+}
+
+void rs_add(struct rswriter *w, const union rsval *row)
+{
+  int c;
+
+  for (c = 0; c < w->ncols; c++)
+    memcpy(w->col[c] + (size_t)w->nrows * w->cols[c].width, &row[c], w->cols[c].width);
+  if (++w->nrows == RS_BLOCKROWS)
+    flush(w);
+}
+
+int rs_close(struct rswriter *w)
+{
+  int c, error;
+
+  flush(w);
+  error = w->error || close(w->fd) < 0;
+  for (c = 0; c < w->ncols; c++)
+    free(w->col[c]);
+  free(w->block);
+  free(w);
+  return error ? -1 : 0;
+}
+
+/********* reading ************/
+
+int rs_open(struct rsstore *s, const char *file)
+{
+  const struct rsheader *h;
+  struct stat st;
+  void *base;
+  int fd;
+
+  if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    printf("result store %s: %s\n", file, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(struct rsheader) ||
+      (base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    printf("result store %s: not a result store\n", file);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  h = base;
+  s->base = base;
+  s->size = (size_t)st.st_size;
+  s->ncols = (int)h->ncols;
+  s->cols = (const struct rscol *)(h + 1);
+  s->first = sizeof(struct rsheader) + h->ncols * sizeof(struct rscol);
+  if (memcmp(h->magic, RS_MAGIC, 8) != 0 || h->order != RS_ORDER || h->ncols < 1 ||
+      h->ncols > RS_MAXCOLS || s->first > s->size) {
+    printf("result store %s: not a result store%s\n", file,
+           h->order != RS_ORDER ? " (or from a machine of the other byte order)" : "");
+    rs_unmap(s);
+    return -1;
+  }
+  return 0;
+}
+
+void rs_unmap(struct rsstore *s)
+{
+  munmap((void *)s->base, s->size);
+}
+
+int rs_column(const struct rsstore *s, const char *name)
+{
+  int c;
+
+  for (c = 0; c < s->ncols; c++)
+    if (strncmp(s->cols[c].name, name, RS_NAMELEN) == 0)
+      return c;
+  return -1;
+}
+
+/* fill in the block at offset; 0 if there is no (complete) block there */
+static int readblock(const struct rsstore *s, size_t offset, struct rsblock *b)
+{
+  const struct rsblockhdr *bh = (const struct rsblockhdr *)(s->base + offset);
+  const char *p;
+  int c;
+
+  if (offset + sizeof(struct rsblockhdr) > s->size || bh->magic != BLK_MAGIC ||
+      bh->nrows == 0 || bh->nrows > RS_BLOCKROWS || bh->size > s->size - offset ||
+      bh->size != blocksize(s->ncols, s->cols, (int)bh->nrows))
+    return 0;
+  b->offset = offset;
+  b->nrows = (int)bh->nrows;
+  b->min = (const union rsval *)(bh + 1);
+  b->max = b->min + s->ncols;
+  p = (const char *)(b->max + s->ncols);
+  for (c = 0; c < s->ncols; c++) {
+    b->col[c] = p;
+    p += align8((size_t)s->cols[c].width * b->nrows);
+  }
+  return 1;
+}
+
+int rs_firstblock(const struct rsstore *s, struct rsblock *b)
+{
+  return readblock(s, s->first, b);
+}
+
+int rs_nextblock(const struct rsstore *s, struct rsblock *b)
+{
+  return readblock(s, b->offset + ((const struct rsblockhdr *)(s->base + b->offset))->size, b);
+}
+
+union rsval rs_value(const struct rsstore *s, const struct rsblock *b, int c, int i)
+{
+  return getval(s->cols[c].type, b->col[c], i);
+}
+
+#ifdef RESULTS_QUERY
+/* query tool:  cc -O2 -DRESULTS_QUERY -o rsquery results.c
+
+     rsquery FILE                  describe the store, from block metadata only
+     rsquery FILE [-w COND]... [-g COL,...] [-a FUNC[:COL]]... [-s COL,...]
+
+   -w keeps the rows meeting a condition, COL OP VALUE with OP one of
+   = != < <= > >= (quote it for the shell), e.g. -w 'loss<=0.1' or
+   -w protocol=sr.  -g groups the rows by the columns given and -a
+   aggregates each group (or all the rows): count, sum, mean, min or
+   max of a column.  -s prints the columns given of every row kept
+   instead.  Only the columns named are read, and blocks whose min/max
+   rule out a condition are skipped unread. */
+
+#define MAXCONDS  16
+#define MAXGROUP  8
+#define MAXAGGS   16
+
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+enum { AGG_COUNT, AGG_SUM, AGG_MEAN, AGG_MIN, AGG_MAX };
+static const char *aggname[] = {"count", "sum", "mean", "min", "max"};
+
+struct cond {
+  int col;
+  int op;
+  union rsval v;             /* in the column's type */
+};
+
+struct group {
+  union rsval key[MAXGROUP];
+  long count;
+  double acc[MAXAGGS];
+};
+
+static struct rsstore store;
+static struct cond conds[MAXCONDS];
+static int nconds, groupcols[MAXGROUP], ngroupcols, selcols[RS_MAXCOLS], nselcols;
+static int aggs[MAXAGGS], aggcols[MAXAGGS], naggs;
+static struct group *groups;
+static int ngroups, maxgroups;
+static int *table, tablesize;          /* hash table of group indices, -1 if empty */
+
+static void usage(void)
+{
+  printf("usage: rsquery FILE [-w COND]... [-g COL,...] [-a FUNC[:COL]]... [-s COL,...]\n");
+  exit(2);
+}
+
+static int column(const char *name)
+{
+  int c = rs_column(&store, name);
+
+  if (c < 0) {
+    printf("no column %s\n", name);
+    exit(2);
+  }
+  return c;
+}
+
+/* a comma separated list of columns */
+static int columns(char *list, int *cols, int max)
+{
+  char *name;
+  int n = 0;
+
+  for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ","))
+    if (n < max)
+      cols[n++] = column(name);
+  return n;
+}
+
+static union rsval parsevalue(int c, const char *text)
+{
+  union rsval v;
+
+  memset(&v, 0, sizeof(v));
+  switch (store.cols[c].type) {
+  case RS_I32:
+    v.i32 = (int32_t)strtol(text, NULL, 10);
+    break;
+  case RS_I64:
+    v.i64 = strtoll(text, NULL, 10);
+    break;
+  case RS_F64:
+    v.f64 = strtod(text, NULL);
+    break;
+  default:
+    memcpy(v.str8, text, strnlen(text, 8));
+  }
+  return v;
+}
+
+static void parsecond(const char *text)
+{
+  static const char *ops[] = {"=", "!=", "<", "<=", ">", ">="};
+  char name[RS_NAMELEN];
+  size_t n = strcspn(text, "=!<>");
+  int op;
+
+  if (nconds == MAXCONDS || n == 0 || n >= RS_NAMELEN || text[n] == '\0')
+    usage();
+  memcpy(name, text, n);
+  name[n] = '\0';
+  text += n;
+  for (op = OP_GE; op >= OP_EQ; op--)   /* two character operators first */
+    if (strncmp(text, ops[op], strlen(ops[op])) == 0)
+      break;
+  if (op < OP_EQ)
+    usage();
+  conds[nconds].col = column(name);
+  conds[nconds].op = op;
+  conds[nconds].v = parsevalue(conds[nconds].col, text + strlen(ops[op]));
+  nconds++;
+}
+
+static int test(int op, int cmp)
+{
+  switch (op) {
+  case OP_EQ: return cmp == 0;
+  case OP_NE: return cmp != 0;
+  case OP_LT: return cmp < 0;
+  case OP_LE: return cmp <= 0;
+  case OP_GT: return cmp > 0;
+  default:    return cmp >= 0;
+  }
+}
+
+/* could any row of the block meet condition k? */
+static int blockmay(const struct rsblock *b, int k)
+{
+  const struct cond *cd = &conds[k];
+  uint32_t type = store.cols[cd->col].type;
+  int lo = compare(type, &b->min[cd->col], &cd->v), hi = compare(type, &b->max[cd->col], &cd->v);
+
+  switch (cd->op) {
+  case OP_EQ: return lo <= 0 && hi >= 0;
+  case OP_NE: return !(lo == 0 && hi == 0);
+  case OP_LT: return lo < 0;
+  case OP_LE: return lo <= 0;
+  case OP_GT: return hi > 0;
+  default:    return hi >= 0;
+  }
+}
+
+static double number(int c, const struct rsblock *b, int i)
+{
+  switch (store.cols[c].type) {
+  case RS_I32: return ((const int32_t *)b->col[c])[i];
+  case RS_I64: return (double)((const int64_t *)b->col[c])[i];
+  case RS_F64: return ((const double *)b->col[c])[i];
+  default:     return 0.0;
+  }
+}
+
+static void printvalue(int c, union rsval v)
+{
+  switch (store.cols[c].type) {
+  case RS_I32: printf("%12d", (int)v.i32); break;
+  case RS_I64: printf("%12lld", (long long)v.i64); break;
+  case RS_F64: printf("%12g", v.f64); break;
+  default:     printf("%12.8s", v.str8);
+  }
+}
+
+static unsigned long hashkey(const union rsval *key)
+{
+  const unsigned char *p = (const unsigned char *)key;
+  unsigned long h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < ngroupcols * sizeof(union rsval); i++)
+    h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+/* the group with this key, made if need be */
+static struct group *findgroup(const union rsval *key)
+{
+  unsigned long slot;
+  int i, j, a;
+
+  if (2 * (ngroups + 1) > tablesize) {
+    free(table);
+    tablesize = tablesize ? 2 * tablesize : 64;
+    if ((table = malloc(tablesize * sizeof(int))) == NULL)
+      exit(EXIT_FAILURE);
+    for (i = 0; i < tablesize; i++)
+      table[i] = -1;
+    for (j = 0; j < ngroups; j++) {
+      for (slot = hashkey(groups[j].key) & (tablesize - 1); table[slot] >= 0; slot = (slot + 1) & (tablesize - 1))
+        ;
+      table[slot] = j;
+    }
+  }
+  for (slot = hashkey(key) & (tablesize - 1); (i = table[slot]) >= 0; slot = (slot + 1) & (tablesize - 1))
+    if (memcmp(groups[i].key, key, ngroupcols * sizeof(union rsval)) == 0)
+      return &groups[i];
+
+  if (ngroups == maxgroups) {
+    maxgroups = maxgroups ? 2 * maxgroups : 64;
+    if ((groups = realloc(groups, maxgroups * sizeof(struct group))) == NULL)
+      exit(EXIT_FAILURE);
+  }
+  table[slot] = ngroups;
+  memcpy(groups[ngroups].key, key, ngroupcols * sizeof(union rsval));
+  groups[ngroups].count = 0;
+  for (a = 0; a < naggs; a++)
+    groups[ngroups].acc[a] = aggs[a] == AGG_MIN ? 1e308 : aggs[a] == AGG_MAX ? -1e308 : 0.0;
+  return &groups[ngroups++];
+}
+
+static int groupcmp(const void *x, const void *y)
+{
+  const struct group *a = x, *b = y;
+  int g, cmp;
+
+  for (g = 0; g < ngroupcols; g++)
+    if ((cmp = compare(store.cols[groupcols[g]].type, &a->key[g], &b->key[g])) != 0)
+      return cmp;
+  return 0;
+}
+
+static void describe(void)
+{
+  struct rsblock b;
+  union rsval min[RS_MAXCOLS], max[RS_MAXCOLS];
+  static const char *typename[] = {"i32", "i64", "f64", "str8"};
+  long rows = 0, blocks = 0;
+  int c;
+
+  for (c = rs_firstblock(&store, &b); c; c = rs_nextblock(&store, &b)) {
+    for (c = 0; c < store.ncols; c++) {
+      if (blocks == 0 || compare(store.cols[c].type, &b.min[c], &min[c]) < 0)
+        min[c] = b.min[c];
+      if (blocks == 0 || compare(store.cols[c].type, &b.max[c], &max[c]) > 0)
+        max[c] = b.max[c];
+    }
+    rows += b.nrows;
+    blocks++;
+  }
+  printf("%ld rows in %ld blocks, %lu bytes\n", rows, blocks, (unsigned long)store.size);
+  printf("%-24s %-5s %12s %12s\n", "column", "type", "min", "max");
+  for (c = 0; c < store.ncols; c++) {
+    printf("%-24.24s %-5s ", store.cols[c].name, typename[store.cols[c].type & 3]);
+    if (blocks > 0) {
+      printvalue(c, min[c]);
+      printf(" ");
+      printvalue(c, max[c]);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static int sel[RS_BLOCKROWS];
+  struct rsblock b;
+  union rsval key[MAXGROUP];
+  struct group *gr;
+  long scanned = 0, skipped = 0;
+  char *colon;
+  int i, k, n, g, a, more, opt;
+
+  if (argc < 2 || rs_open(&store, argv[1]) < 0)
+    usage();
+  if (argc == 2) {
+    describe();
+    return 0;
+  }
+  for (i = 2; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 == argc)
+      usage();
+    opt = argv[i++][1];
+    if (opt == 'w')
+      parsecond(argv[i]);
+    else if (opt == 'g')
+      ngroupcols = columns(argv[i], groupcols, MAXGROUP);
+    else if (opt == 's')
+      nselcols = columns(argv[i], selcols, RS_MAXCOLS);
+    else if (opt == 'a' && naggs < MAXAGGS) {
+      if ((colon = strchr(argv[i], ':')) != NULL)
+        *colon = '\0';
+      for (a = AGG_COUNT; a <= AGG_MAX && strcmp(argv[i], aggname[a]) != 0; a++)
+        ;
+      if (a > AGG_MAX || (a != AGG_COUNT && colon == NULL))
+        usage();
+      aggs[naggs] = a;
+      aggcols[naggs++] = colon != NULL ? column(colon + 1) : -1;
+    }
+    else
+      usage();
+  }
+  if (naggs == 0 && nselcols == 0)
+    aggs[naggs++] = AGG_COUNT;
+
+  if (nselcols > 0) {
+    for (k = 0; k < nselcols; k++)
+      printf("%12.12s", store.cols[selcols[k]].name);
+    printf("\n");
+  }
+  else if (ngroupcols == 0)
+    findgroup(key);          /* everything is one group, even with no rows */
+
+  for (more = rs_firstblock(&store, &b); more; more = rs_nextblock(&store, &b)) {
+    for (k = 0; k < nconds && blockmay(&b, k); k++)
+      ;
+    if (k < nconds) {
+      skipped++;
+      continue;
+    }
+    scanned++;
+    /* narrow the selection one condition, so one column, at a time */
+    for (n = 0; n < b.nrows; n++)
+      sel[n] = n;
+    for (k = 0; k < nconds; k++) {
+      union rsval v;
+      int m = 0;
+
+      for (i = 0; i < n; i++) {
+        v = rs_value(&store, &b, conds[k].col, sel[i]);
+        if (test(conds[k].op, compare(store.cols[conds[k].col].type, &v, &conds[k].v)))
+          sel[m++] = sel[i];
+      }
+      n = m;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (nselcols > 0) {
+        for (k = 0; k < nselcols; k++)
+          printvalue(selcols[k], rs_value(&store, &b, selcols[k], sel[i]));
+        printf("\n");
+        continue;
+      }
+      memset(key, 0, sizeof(key));
+      for (g = 0; g < ngroupcols; g++)
+        key[g] = rs_value(&store, &b, groupcols[g], sel[i]);
+      gr = findgroup(key);
+      gr->count++;
+      for (a = 0; a < naggs; a++) {
+        double x = aggcols[a] >= 0 ? number(aggcols[a], &b, sel[i]) : 0.0;
+
+        if (aggs[a] == AGG_SUM || aggs[a] == AGG_MEAN)
+          gr->acc[a] += x;
+        else if (aggs[a] == AGG_MIN && x < gr->acc[a])
+          gr->acc[a] = x;
+        else if (aggs[a] == AGG_MAX && x > gr->acc[a])
+          gr->acc[a] = x;
+      }
+    }
+  }
+
+  if (nselcols == 0) {
+    qsort(groups, ngroups, sizeof(struct group), groupcmp);
+    for (g = 0; g < ngroupcols; g++)
+      printf("%12.12s", store.cols[groupcols[g]].name);
+    for (a = 0; a < naggs; a++) {
+      char label[48];
+
+      snprintf(label, sizeof(label), aggcols[a] >= 0 ? "%s(%s)" : "%s", aggname[aggs[a]],
+               aggcols[a] >= 0 ? store.cols[aggcols[a]].name : "");
+      printf(" %15.15s", label);
+    }
+    printf("\n");
+    for (i = 0; i < ngroups; i++) {
+      for (g = 0; g < ngroupcols; g++)
+        printvalue(groupcols[g], groups[i].key[g]);
+      for (a = 0; a < naggs; a++)
+        if (aggs[a] == AGG_COUNT)
+          printf(" %15ld", groups[i].count);
+        else if (groups[i].count == 0)
+          printf(" %15s", "-");
+        else
+          printf(" %15g", aggs[a] == AGG_MEAN ? groups[i].acc[a] / groups[i].count : groups[i].acc[a]);
+      printf("\n");
+    }
+  }
+  fprintf(stderr, "%ld blocks scanned, %ld skipped by min/max\n", scanned, skipped);
+  rs_unmap(&store);
+  return 0;
+}
+#endif
@@ -0,0 +1,102 @@
+/* ******************************************************************
+   Columnar result store.
+
+   Sweeps write millions of result rows; a store keeps them in a binary
+   file, column by column, so a query reads only the columns it needs,
+   straight out of a memory mapping, with no parsing.  Every column has a
+   fixed width and type.  The file is a header with the column list and
+   then blocks of up to RS_BLOCKROWS rows:
+
+      header   "RSTORE1\n", column count, then per column its name and type
+      block    row count, size, then per column the min and max over the
+               block, then each column as an array of nrows values
+      block    ...
+
+   Everything is 8 byte aligned, so a column is a plain C array in the
+   mapping.  The min/max let a query skip whole blocks without touching
+   their data.  Rows are only ever appended, a block at a time, so
+   several runs can add to one store one after another (not at the same
+   time); a block cut short by a crash while writing it is ignored by
+   readers and cut off by the next writer.  Values are in the host's
+   byte order, which the header records; a store is read on the kind of
+   machine that wrote it.
+**********************************************************************/
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RS_BLOCKROWS 4096
+#define RS_NAMELEN   24
+#define RS_MAXCOLS   64
+
+enum rstype {
+  RS_I32,                    /* int32_t */
+  RS_I64,                    /* int64_t */
+  RS_F64,                    /* double */
+  RS_STR8                    /* up to 8 characters, NUL padded */
+};
+
+/* a value of any column type */
+union rsval {
+  int32_t i32;
+  int64_t i64;
+  double f64;
+  char str8[8];
+};
+
+struct rscol {
+  char name[RS_NAMELEN];
+  uint32_t type;             /* enum rstype */
+  uint32_t width;            /* bytes per value */
+};
+
+/********* writing ************/
+
+struct rswriter;
+
+/* open the store in file for appending rows with the columns cols,
+   creating it if it does not exist; NULL (with a message) if it exists
+   with other columns or cannot be written */
+extern struct rswriter *rs_create(const char *file, const struct rscol *cols, int ncols);
+
+/* add a row, one value per column */
+extern void rs_add(struct rswriter *, const union rsval *row);
+
+/* write out the rows added and close the store; returns -1 on a write error */
+extern int rs_close(struct rswriter *);
+
+/********* reading ************/
+
+struct rsstore {
+  const char *base;          /* the mapping */
+  size_t size;
+  int ncols;
+  const struct rscol *cols;
+  size_t first;              /* offset of the first block */
+};
+
+struct rsblock {
+  size_t offset;             /* of the block in the file */
+  int nrows;
+  const union rsval *min;    /* per column, over the block */
+  const union rsval *max;
+  const char *col[RS_MAXCOLS];  /* the column arrays */
+};
+
+/* map a store for reading; returns -1 (with a message) if it is not one */
+extern int rs_open(struct rsstore *, const char *file);
+extern void rs_unmap(struct rsstore *);
+
+/* the column called name, or -1 */
+extern int rs_column(const struct rsstore *, const char *name);
+
+/* the first block, and the one after b; return 0 when there are no more */
+extern int rs_firstblock(const struct rsstore *, struct rsblock *);
+extern int rs_nextblock(const struct rsstore *, struct rsblock *);
+
+/* value in row i of column c of a block */
+extern union rsval rs_value(const struct rsstore *, const struct rsblock *, int c, int i);
+
+#endif
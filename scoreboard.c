@@ -0,0 +1,317 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "scoreboard.h"
+
+/* ******************************************************************
+   SACK scoreboard: acknowledged ranges in a treap.  See scoreboard.h.
+
+   The ranges are disjoint and never touch (touching ranges are merged),
+   so ordering them by start also orders them by end.  A treap keeps the
+   tree balanced with random priorities; every operation is a split of
+   the tree at a sequence number, some work on the pieces, and a merge,
+   each taking O(log n) expected time.
+**********************************************************************/
+
+struct sbrange {
+  uint32_t start, end;       /* [start,end) is acknowledged */
+  uint32_t prio;             /* heap order: a parent's prio is at least its children's */
+  struct sbrange *left, *right;
+};
+
+/* serial number comparisons */
+#define SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+
+static struct sbrange *newrange(struct scoreboard *sb, uint32_t start, uint32_t end)
+{
+  struct sbrange *r = sb->spare;
+
+  if (r != NULL)
+    sb->spare = r->right;
+  else if ((r = malloc(sizeof(struct sbrange))) == NULL) {
+    printf("memory allocation for scoreboard failed.");
+    exit(EXIT_FAILURE);
+  }
+  sb->seed ^= sb->seed << 13;   /* xorshift */
+  sb->seed ^= sb->seed >> 17;
+  sb->seed ^= sb->seed << 5;
+  r->start = start;
+  r->end = end;
+  r->prio = sb->seed;
+  r->left = r->right = NULL;
+  sb->nranges++;
+  return r;
+}
+
+/* give back every node of the tree t */
+static void freetree(struct scoreboard *sb, struct sbrange *t)
+{
+  if (t == NULL)
+    return;
+  freetree(sb, t->left);
+  freetree(sb, t->right);
+  t->right = sb->spare;
+  sb->spare = t;
+  sb->nranges--;
+}
+
+/* split t into the ranges starting before seq (*lt) and the rest (*ge) */
+static void split(struct sbrange *t, uint32_t seq, struct sbrange **lt, struct sbrange **ge)
+{
+  if (t == NULL)
+    *lt = *ge = NULL;
+  else if (SEQ_LT(t->start, seq)) {
+    split(t->right, seq, &t->right, ge);
+    *lt = t;
+  }
+  else {
+    split(t->left, seq, lt, &t->left);
+    *ge = t;
+  }
+}
+
+/* join two trees, every range of a being before every range of b */
+static struct sbrange *merge(struct sbrange *a, struct sbrange *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->prio >= b->prio) {
+    a->right = merge(a->right, b);
+    return a;
+  }
+  b->left = merge(a, b->left);
+  return b;
+}
+
+/* take the last range out of t and return it in *last */
+static struct sbrange *poplast(struct sbrange *t, struct sbrange **last)
+{
+  if (t->right == NULL) {
+    *last = t;
+    return t->left;
+  }
+  t->right = poplast(t->right, last);
+  return t;
+}
+
+static struct sbrange *last(struct sbrange *t)
+{
+  while (t != NULL && t->right != NULL)
+    t = t->right;
+  return t;
+}
+
+/* the range with the greatest start at or before seq, or NULL */
+static const struct sbrange *floorrange(const struct sbrange *t, uint32_t seq)
+{
+  const struct sbrange *best = NULL;
+
+  while (t != NULL)
+    if (SEQ_LEQ(t->start, seq)) {
+      best = t;
+      t = t->right;
+    }
+    else
+      t = t->left;
+  return best;
+}
+
+/* the range with the smallest start after seq, or NULL */
+static const struct sbrange *higherrange(const struct sbrange *t, uint32_t seq)
+{
+  const struct sbrange *best = NULL;
+
+  while (t != NULL)
+    if (SEQ_LT(seq, t->start)) {
+      best = t;
+      t = t->left;
+    }
+    else
+      t = t->right;
+  return best;
+}
+
+/* sum of the lengths of the ranges in t */
+static uint32_t covered(const struct sbrange *t)
+{
+  return t == NULL ? 0 : (t->end - t->start) + covered(t->left) + covered(t->right);
+}
+
+void sb_init(struct scoreboard *sb, uint32_t base)
+{
+  sb->base = sb->high = base;
+  sb->nranges = 0;
+  sb->root = sb->spare = NULL;
+  sb->seed = 2463534242u;
+}
+
+void sb_free(struct scoreboard *sb)
+{
+  struct sbrange *r;
+
+  freetree(sb, sb->root);
+  sb->root = NULL;
+  while ((r = sb->spare) != NULL) {
+    sb->spare = r->right;
+    free(r);
+  }
+}
+
+uint32_t sb_ack(struct scoreboard *sb, uint32_t start, uint32_t end)
+{
+  struct sbrange *before, *mid, *after, *prev;
+  uint32_t added;
+
+  if (SEQ_LT(start, sb->base))
+    start = sb->base;
+  if (SEQ_LEQ(end, start))
+    return 0;
+  added = end - start;
+
+  /* a range before start that reaches it is absorbed */
+  split(sb->root, start, &before, &after);
+  if (before != NULL && SEQ_LEQ(start, last(before)->end)) {
+    before = poplast(before, &prev);
+    added -= (SEQ_LT(end, prev->end) ? end : prev->end) - start;
+    start = prev->start;
+    if (SEQ_LT(end, prev->end))
+      end = prev->end;
+    prev->left = prev->right = NULL;
+    freetree(sb, prev);
+  }
+  /* and so is every range starting inside [start,end] */
+  split(after, end + 1, &mid, &after);
+  if (mid != NULL) {
+    added -= covered(mid);
+    if (SEQ_LT(end, last(mid)->end)) {
+      added += last(mid)->end - end;
+      end = last(mid)->end;
+    }
+    freetree(sb, mid);
+  }
+
+  if (start == sb->base) {
+    /* contiguous with the base: slide it */
+    sb->base = end;
+    sb->root = merge(before, after);
+  }
+  else
+    sb->root = merge(merge(before, newrange(sb, start, end)), after);
+  if (SEQ_LT(sb->high, end))
+    sb->high = end;
+  return added;
+}
+
+int sb_isacked(const struct scoreboard *sb, uint32_t seq)
+{
+  const struct sbrange *r;
+
+  if (SEQ_LT(seq, sb->base))
+    return 1;
+  r = floorrange(sb->root, seq);
+  return r != NULL && SEQ_LT(seq, r->end);
+}
+
+int sb_nexthole(const struct scoreboard *sb, uint32_t seq, uint32_t *start, uint32_t *end)
+{
+  const struct sbrange *r;
+
+  if (SEQ_LT(seq, sb->base))
+    seq = sb->base;
+  r = floorrange(sb->root, seq);
+  if (r != NULL && SEQ_LT(seq, r->end))
+    seq = r->end;           /* inside an acknowledged range: the hole is after it */
+  r = higherrange(sb->root, seq);
+  if (r == NULL)
+    return 0;               /* nothing acknowledged above: not a hole (yet) */
+  *start = seq;
+  *end = r->start;
+  return 1;
+}
+
+#ifdef SCOREBOARD_BENCH
+/* scoreboard against a flag per packet, for a large window with sparse
+   loss:  cc -O2 -DSCOREBOARD_BENCH -o sbbench scoreboard.c */
+#include <time.h>
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* next unacknowledged packet at or after seq below high, with a flag per packet */
+static long flagnexthole(const char *acked, long window, long seq, long high)
+{
+  for (; seq < high; seq++)
+    if (!acked[seq % window])
+      return seq;
+  return -1;
+}
+
+int main(int argc, char **argv)
+{
+  long window = argc > 1 ? atol(argv[1]) : 100000;
+  double loss = argc > 2 ? atof(argv[2]) : 0.001;
+  long rounds = 20, seq, base, i, nlost, holes, high, h;
+  char *acked = calloc(window, 1);
+  struct scoreboard sb;
+  uint32_t hs, he;
+  double t0, tsbins = 0, tsbhole = 0, tflhole = 0;
+  long nins = 0, nhole = 0;
+
+  if (acked == NULL)
+    return 1;
+  srand(1);
+  sb_init(&sb, 0);
+  base = 0;
+  /* each round a full window is sent and ACKed one packet at a time,
+     then the holes are found and repaired, which slides the base */
+  for (i = 0; i < rounds; i++) {
+    nlost = 0;
+    t0 = now();
+    for (seq = base; seq < base + window; seq++)
+      if ((double)rand() / RAND_MAX >= loss) {
+        sb_ack(&sb, (uint32_t)seq, (uint32_t)seq + 1);
+        nins++;
+      }
+      else
+        nlost++;
+    tsbins += now() - t0;
+    /* the same ACKs as flags (not timed: it is a store per packet either way) */
+    high = base + window;
+    for (seq = base; seq < high; seq++)
+      acked[seq % window] = sb_isacked(&sb, (uint32_t)seq);
+
+    holes = sb.nranges;
+    t0 = now();
+    for (seq = base, h = 0; sb_nexthole(&sb, (uint32_t)seq, &hs, &he); h++)
+      seq = (long)he;
+    tsbhole += now() - t0;
+    t0 = now();
+    for (seq = base; (seq = flagnexthole(acked, window, seq, (long)sb.high)) >= 0; seq++)
+      ;
+    tflhole += now() - t0;
+    nhole += h;
+
+    /* repair the holes: the base slides to the end of the window */
+    while (sb_nexthole(&sb, sb.base, &hs, &he))
+      sb_ack(&sb, hs, he);
+    for (seq = base; seq < high; seq++)
+      acked[seq % window] = 0;
+    base = (long)sb.base;
+    if (i == 0)
+      printf("window %ld, loss %g: %ld lost, %ld holes, %d bytes per hole\n",
+             window, loss, nlost, holes, (int)sizeof(struct sbrange));
+  }
+  printf("scoreboard: %.1f ns per ACK insert, %.1f ns per hole found (%.0f ns per scan)\n",
+         tsbins / nins, tsbhole / nhole, tsbhole / rounds);
+  printf("flags:      %.0f ns per scan for holes, %ld bytes of state\n", tflhole / rounds, window);
+  sb_free(&sb);
+  return base != window * rounds;
+}
+#endif
@@ -0,0 +1,62 @@
+/* ******************************************************************
+   SACK scoreboard for selective repeat senders with large windows.
+
+   A sender with a window of many thousands of packets and little loss
+   has almost everything it sent acknowledged; what matters are the few
+   holes.  Instead of a flag per packet the scoreboard keeps the
+   cumulative ACK point (base) and, above it, the sorted ranges of
+   sequence numbers that have been selectively acknowledged, e.g. from
+   the SACK blocks of wire.h:
+
+      base           ranges [start,end)
+       |               ____      _______            ___
+   ----+..............|____|....|_______|..........|___|---->
+        \____________/      \__/         \________/
+            holes: sent but not (yet) acknowledged
+
+   The ranges are held in a balanced search tree, so adding an ACK range,
+   finding the next hole to retransmit and sliding the base all take
+   O(log holes) time (plus the ranges an ACK swallows), and the memory
+   used is proportional to the number of holes, not to the window.
+
+   Sequence numbers are 32 bit and may wrap; they are compared in serial
+   number arithmetic, so everything in the scoreboard must lie within
+   2^31 of base.
+**********************************************************************/
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <stdint.h>
+
+struct sbrange;
+
+struct scoreboard {
+  uint32_t base;             /* everything before base is acknowledged */
+  uint32_t high;             /* end of the highest acknowledged range (base if none) */
+  int nranges;               /* ranges above base, one hole before each */
+  struct sbrange *root;      /* the ranges, as a treap keyed by start */
+  struct sbrange *spare;     /* free nodes, for reuse */
+  uint32_t seed;             /* for the treap priorities */
+};
+
+/* an empty scoreboard whose base is base */
+extern void sb_init(struct scoreboard *sb, uint32_t base);
+
+/* release the scoreboard's memory */
+extern void sb_free(struct scoreboard *sb);
+
+/* record that [start,end) has been acknowledged.  A cumulative ACK of n
+   is sb_ack(sb, sb->base, n).  Parts below base are ignored; a range
+   reaching base slides it forward.  Returns the number of sequence
+   numbers that were not acknowledged before. */
+extern uint32_t sb_ack(struct scoreboard *sb, uint32_t start, uint32_t end);
+
+/* has seq been acknowledged? */
+extern int sb_isacked(const struct scoreboard *sb, uint32_t seq);
+
+/* the first hole at or after seq: sets [*start,*end) to the run of
+   unacknowledged sequence numbers and returns 1, or returns 0 if nothing
+   at or after seq lies below an acknowledged range */
+extern int sb_nexthole(const struct scoreboard *sb, uint32_t seq, uint32_t *start, uint32_t *end);
+
+#endif
@@ -23,12 +23,31 @@
    - added GBN implementation
 **********************************************************************/
 
+/* RTT and WINDOWSIZE can be set with -D, to try other values */
+#ifndef RTT
 #define RTT 16.0                  /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6              /* the maximum number of buffered unacked packet \
                                     MUST BE SET TO 6 when submitting assignment */
+#endif
 #define SEQSPACE (2 * WINDOWSIZE) /* the min sequence space for SR must be at least windowsize * 2 */
 #define NOTINUSE (-1)             /* used to fill header fields that are not being used */
 
+const char protocol_name[] = "sr";
+const int protocol_window = WINDOWSIZE;
+const double protocol_rtt = RTT;
+
+/* transmit scheduler (see TxPump()).  TXRATE paces the sender to that
+   many packets per time unit, 0 sends everything at once; TXPOLICY is the
+   order the transmit queues are served in.  Both can be set with -D. */
+#ifndef TXRATE
+#define TXRATE 0.0                /* packets per time unit, 0 = no pacing */
+#endif
+#ifndef TXPOLICY
+#define TXPOLICY "rpn"            /* r = retransmissions, p = probes, n = new data */
+#endif
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
@@ -55,74 +74,538 @@ int IsCorrupted(struct pkt packet)
     return 0;
 }
 
+/* windows are rings indexed by sequence number: sequence number s lives in
+   slot s % WINDOWSIZE.  Since SEQSPACE is twice the window size, the
+   WINDOWSIZE consecutive sequence numbers of a window never share a slot,
+   so sliding a window never moves anything.
+
+   The ring is split in two.  The per-slot header state is small and is
+   what ACK processing and window slides scan; the packets themselves are
+   only read when they are (re)sent or delivered, so they are kept in a
+   separate array and stay out of the way of the scans. */
+struct slot
+{
+  int seqnum;   /* sequence number of the packet held in the slot */
+  bool inuse;   /* slot holds a packet of the current window */
+  bool acked;   /* sender: packet has been ACKed.  receiver: not used */
+  char queued;  /* sender: transmit queue it waits in ('r', 'p' or 'n'), 0 if none */
+  bool endsub;  /* sender: last packet of a submission (see A_outputv()) */
+  short txprev; /* sender: neighbouring slots in that queue, -1 at the ends */
+  short txnext;
+};
+
+/* distance of seqnum from base, going forward round the sequence space */
+static int SeqOffset(int base, int seqnum)
+{
+  return (seqnum - base + SEQSPACE) % SEQSPACE;
+}
+
+/* is seqnum in the window of WINDOWSIZE sequence numbers starting at base? */
+static bool InWindow(int base, int seqnum)
+{
+  return SeqOffset(base, seqnum) < WINDOWSIZE;
+}
+
+/* Connection state.  A connection that has nothing in flight only needs
+   its sequence numbers and its timer, so that is all a connection holds;
+   the window rings, a couple of hundred bytes each, are taken from a
+   pool when the first packet goes into one and given back as soon as it
+   empties.  With many mostly idle connections this keeps the idle cost
+   to a few dozen bytes.  The A_ and B_ routines work on the selected
+   connection (see sr_select()); the emulator only ever uses the one that
+   is selected to start with. */
+struct ring
+{
+  struct slot slot[WINDOWSIZE];  /* header state of the packets in the window */
+  union
+  {
+    struct pktbuf *buf[WINDOWSIZE];  /* sender: the packets, shared with the medium */
+    char payload[WINDOWSIZE][20];    /* receiver: their payloads */
+  } u;                           /* by the same slot */
+  struct submission *subhead;    /* sender: submissions not yet acknowledged, oldest first */
+  struct submission *subtail;
+  struct submission *subnext;    /* sender: first submission not yet all packetized */
+  short txhead[3], txtail[3];    /* sender: transmit queues (see TxQueue()), -1 if empty */
+  struct ring *next;             /* next ring on the free list */
+};
+
+/* a scatter/gather submission (see A_outputv()).  The buffers are the
+   application's; only the list of them is copied. */
+struct submission
+{
+  struct submission *next;
+  void (*done)(void *);          /* called with cookie once all of it is ACKed */
+  void *cookie;
+  int iovcnt;
+  int iovpos;                    /* buffer the next packet starts in */
+  size_t off;                    /* and where in it */
+  struct msgvec iov[];
+};
+
+struct srconn
+{
+  struct ring *A_ring;           /* sender window, NULL while nothing awaits an ACK */
+  struct ring *B_ring;           /* receiver window, NULL while nothing is buffered */
+  float A_deadline;              /* when the oldest unACKed packet is due for retransmission */
+  float A_txnext;                /* when the pacer lets the next packet out */
+  unsigned short A_baseseqnum;   /* the first sequence number in sender's window */
+  unsigned short A_nextseqnum;   /* the next sequence number to be used by the sender */
+  unsigned short windowcount;    /* the number of packets currently awaiting an ACK */
+  unsigned short B_baseseqnum;   /* first sequence number of the receiver's window */
+  unsigned short B_buffered;     /* packets held in the window waiting for the base */
+  bool A_timerrunning;           /* the emulator timer is armed */
+  bool A_txscheduled;            /* a pacing event is pending */
+  bool freed;                    /* sr_freeconn() was called while pacing events were pending */
+  unsigned short A_txevents;     /* pacing events pending, each holding a pointer to this */
+  unsigned char A_timeouts;      /* timeouts since the last new ACK */
+};
+
+/* an idle connection is 48 bytes on LP64; fail to compile if it grows */
+typedef char srconn_idle_size[sizeof(struct srconn) <= 48 ? 1 : -1];
+
+static struct srconn defaultconn;
+static struct srconn *conn = &defaultconn;  /* the connection A_ and B_ routines act on */
+static struct ring *freerings;              /* rings not attached to any connection */
+
+/* attach an empty ring */
+static struct ring *GetRing(void)
+{
+  struct ring *r;
+  int i;
+
+  if (freerings != NULL)
+  {
+    r = freerings;
+    freerings = r->next;
+  }
+  else
+  {
+    r = malloc(sizeof(struct ring));
+    if (r == NULL)
+    {
+      printf("memory allocation for window failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < WINDOWSIZE; i++)
+  {
+    r->slot[i].inuse = false;
+    r->slot[i].queued = 0;
+    r->slot[i].endsub = false;
+  }
+  for (i = 0; i < 3; i++)
+    r->txhead[i] = r->txtail[i] = -1;
+  r->subhead = r->subtail = r->subnext = NULL;
+  return r;
+}
+
+/* give back a ring that no longer holds anything.  A sender's packets
+   must have been let go (see PutSent()); the submissions still on it,
+   which will not be sent now, are returned for the caller to Complete()
+   once the connection no longer refers to the ring. */
+static struct submission *PutRing(struct ring *r)
+{
+  struct submission *sub = r->subhead;
+
+  r->subhead = r->subtail = r->subnext = NULL;
+  r->next = freerings;
+  freerings = r;
+  return sub;
+}
+
+static bool cancelling;  /* the submissions being completed were not all sent */
+
+/* call done(cookie) for a list of submissions, oldest first, and free
+   them.  done may submit more, so the connection must be in order first. */
+static void Complete(struct submission *list, bool cancelled)
+{
+  struct submission *sub;
+
+  while ((sub = list) != NULL)
+  {
+    list = sub->next;
+    cancelling = cancelled;
+    if (sub->done != NULL)
+      sub->done(sub->cookie);
+    cancelling = false;
+    free(sub);
+  }
+}
+
+int sr_cancelled(void)
+{
+  return cancelling;
+}
+
+/* let go of the packets still in a sender's window */
+static void PutSent(struct ring *r)
+{
+  int i;
+
+  for (i = 0; i < WINDOWSIZE; i++)
+    if (r->slot[i].inuse)
+    {
+      pb_put(r->u.buf[i]);
+      r->slot[i].inuse = false;
+    }
+}
+
+struct srconn *sr_newconn(void)
+{
+  struct srconn *c = calloc(1, sizeof(struct srconn));
+
+  if (c == NULL)
+  {
+    printf("memory allocation for connection failed.");
+    exit(EXIT_FAILURE);
+  }
+  return c;
+}
+
+void sr_freeconn(struct srconn *c)
+{
+  struct submission *cancelled = NULL;
+
+  if (c->A_ring != NULL)
+  {
+    PutSent(c->A_ring);
+    cancelled = PutRing(c->A_ring);
+  }
+  if (c->B_ring != NULL)
+    PutRing(c->B_ring);
+  if (conn == c)
+    conn = &defaultconn;
+  /* a pending pacing event still points here: the last one frees it */
+  if (c->A_txevents > 0)
+    c->freed = true;
+  else
+    free(c);
+  Complete(cancelled, true);
+}
+
+void sr_select(struct srconn *c)
+{
+  conn = c;
+}
+
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE]; /* array for storing packets waiting for ACK */
-static int windowcount;               /* the number of packets currently awaiting an ACK */
-static int A_baseseqnum;              /* the first sequece number in sender's window */
-static int A_nextseqnum;              /* the next sequence number to be used by the sender */
+/* Retransmission timer.  Instead of stopping and restarting the emulator
+   timer on every ACK, the sender keeps a logical deadline for the oldest
+   unacknowledged packet and just moves it.  The deadline only ever moves
+   later, so a running timer never needs cancelling: when it goes off early
+   it is simply re-armed for the deadline.  The emulator timer is only
+   started when none is running. */
+#define TIMER_SLACK 0.001          /* a timer this close to the deadline counts as on time */
+
+/* make sure a timer will go off no later than A_deadline */
+static void ArmTimer(void)
+{
+  if (!conn->A_timerrunning)
+  {
+    starttimer(A, conn->A_deadline - get_sim_time());
+    conn->A_timerrunning = true;
+  }
+}
+
+/* Transmit scheduler.  Every packet the sender puts on the wire goes
+   through one of three queues: new data, retransmissions of packets
+   whose timer expired, and probes.  A timeout that follows another with
+   no new ACK in between is more likely a dead path or a receiver that is
+   holding back than a loss, so its retransmission is a probe.  The queues
+   are lists threaded through the window slots, so they cost nothing while
+   idle and the next packet to send is found without a scan.  New data is
+   queued in sequence order and only the base is ever retransmitted, so
+   appending keeps each queue oldest first.  TxPump() serves them in
+   TXPOLICY order, oldest packet first within a queue, as fast as the
+   TXRATE pacer allows; by default neither a loss
+   repair nor a probe (which is also a repair of the base, tried again)
+   ever waits behind new data.  When the pacer holds packets back, a
+   pacing event brings the sender back when the next may go. */
+static int txevent = -1;           /* event type of the pacing event */
+
+static void TxPump(void);
+
+/* the list of transmit queue q, -1 if q is not one */
+static int TxList(char q)
+{
+  return q == 'r' ? 0 : q == 'p' ? 1 : q == 'n' ? 2 : -1;
+}
+
+/* put the packet in slot index at the back of transmit queue q */
+static void TxQueue(int index, char q)
+{
+  struct ring *r = conn->A_ring;
+  int k = TxList(q);
+
+  r->slot[index].queued = q;
+  r->slot[index].txnext = -1;
+  r->slot[index].txprev = r->txtail[k];
+  if (r->txtail[k] < 0)
+    r->txhead[k] = index;
+  else
+    r->slot[r->txtail[k]].txnext = index;
+  r->txtail[k] = index;
+}
+
+/* take the packet in slot index off the transmit queue it is in, if any */
+static void TxDequeue(int index)
+{
+  struct ring *r = conn->A_ring;
+  struct slot *sl = &r->slot[index];
+  int k = TxList(sl->queued);
+
+  if (k < 0)
+    return;
+  if (sl->txprev < 0)
+    r->txhead[k] = sl->txnext;
+  else
+    r->slot[sl->txprev].txnext = sl->txnext;
+  if (sl->txnext < 0)
+    r->txtail[k] = sl->txprev;
+  else
+    r->slot[sl->txnext].txprev = sl->txprev;
+  sl->queued = 0;
+}
+
+/* the packet to send next under TXPOLICY, or -1 if nothing is queued */
+static int TxNext(void)
+{
+  const char *p;
+  int k;
+
+  if (conn->A_ring == NULL)
+    return -1;
+  for (p = TXPOLICY "rpn"; *p != '\0'; p++)   /* queues missing from the policy go last */
+    if ((k = TxList(*p)) >= 0 && conn->A_ring->txhead[k] >= 0)
+      return conn->A_ring->txhead[k];
+  return -1;
+}
+
+/* hand the packet in slot index to layer 3 */
+static void TxSend(int index)
+{
+  struct slot *sl = &conn->A_ring->slot[index];
+
+  if (sl->queued == 'n')
+  {
+    if (TRACE > 0)
+      printf("Sending packet %d to layer 3\n", sl->seqnum);
+    /* the base starts the timer when it first goes out */
+    if (sl->seqnum == conn->A_baseseqnum)
+    {
+      conn->A_deadline = get_sim_time() + RTT;
+      ArmTimer();
+    }
+  }
+  else
+  {
+    if (TRACE > 0)
+      printf("---A: resending packet %d\n", sl->seqnum);
+    stat_add(STAT_PACKETS_RESENT, 1);
+  }
+  TxDequeue(index);
+  tolayer3_buf(A, conn->A_ring->u.buf[index]);
+}
+
+/* pacing event: the sender of connection c may transmit again */
+static void TxEvent(int AorB, void *p)
+{
+  struct srconn *saved = conn, *c = p;
+
+  (void)AorB;
+  c->A_txevents--;
+  if (c->freed)
+  {
+    if (c->A_txevents == 0)
+      free(c);
+    return;
+  }
+  conn = c;
+  conn->A_txscheduled = false;
+  TxPump();
+  conn = saved;
+}
+
+/* send queued packets as the policy and pacer allow */
+static void TxPump(void)
+{
+  float now = get_sim_time();
+  int index;
+
+  while ((index = TxNext()) >= 0)
+  {
+    if (TXRATE > 0.0 && conn->A_txnext - now > TIMER_SLACK)
+    {
+      if (!conn->A_txscheduled)
+      {
+        scheduleevent(txevent, A, conn->A_txnext - now, conn);
+        conn->A_txscheduled = true;
+        conn->A_txevents++;
+      }
+      return;
+    }
+    TxSend(index);
+    if (TXRATE > 0.0)
+      conn->A_txnext = (conn->A_txnext > now ? conn->A_txnext : now) + 1.0 / TXRATE;
+  }
+}
+
+/* put sendpkt, whose payload is filled in, into the window with the next
+   sequence number and queue it as new data; returns its slot */
+static int WindowAdd(struct pkt *sendpkt)
+{
+  struct ring *r;
+  int index;
+
+  sendpkt->seqnum = conn->A_nextseqnum;
+  sendpkt->acknum = NOTINUSE;
+  sendpkt->checksum = ComputeChecksum(*sendpkt);
+
+  /* put packet in window buffer */
+  if (conn->A_ring == NULL)
+    conn->A_ring = GetRing();
+  r = conn->A_ring;
+  index = conn->A_nextseqnum % WINDOWSIZE;
+  r->slot[index].seqnum = sendpkt->seqnum;
+  r->slot[index].inuse = true;
+  r->slot[index].acked = false;
+  r->slot[index].endsub = false;
+  r->u.buf[index] = pb_alloc(sendpkt);
+  conn->windowcount++;
+  tracecounter(A, "window", conn->windowcount);
+
+  /* get next sequence number, wrap back to 0 */
+  conn->A_nextseqnum = (conn->A_nextseqnum + 1) % SEQSPACE;
+
+  /* send it when the scheduler gets to it; the base starts the timer then */
+  TxQueue(index, 'n');
+  return index;
+}
+
+/* step over empty buffers */
+static void SkipEmpty(struct submission *sub)
+{
+  while (sub->iovpos < sub->iovcnt && sub->off == sub->iov[sub->iovpos].len)
+  {
+    sub->iovpos++;
+    sub->off = 0;
+  }
+}
+
+/* cut submitted data into packets while there is room in the window,
+   gathering each payload straight from the application's buffers */
+static void Packetize(void)
+{
+  struct submission *sub;
+  struct pkt sendpkt;
+  size_t n, len;
+  int index;
+
+  while (conn->A_ring != NULL && (sub = conn->A_ring->subnext) != NULL &&
+         InWindow(conn->A_baseseqnum, conn->A_nextseqnum))
+  {
+    for (n = 0; n < 20 && sub->iovpos < sub->iovcnt; n += len)
+    {
+      len = sub->iov[sub->iovpos].len - sub->off;
+      if (len > 20 - n)
+        len = 20 - n;
+      memcpy(sendpkt.payload + n, sub->iov[sub->iovpos].base + sub->off, len);
+      sub->off += len;
+      SkipEmpty(sub);
+    }
+    memset(sendpkt.payload + n, 0, 20 - n);
+    index = WindowAdd(&sendpkt);
+    if (sub->iovpos == sub->iovcnt)
+    {
+      conn->A_ring->slot[index].endsub = true;
+      conn->A_ring->subnext = sub->next;
+    }
+  }
+}
+
+/* scatter/gather output: queue the bytes of iovcnt application buffers
+   to be sent, in 20 byte packets, without copying them until they are
+   packetized.  Data that fits in the window is packetized at once, the
+   rest as ACKs make room; unlike A_output() nothing is turned away.
+   Once every packet of the submission has been acknowledged done(cookie)
+   is called, and the buffers may be reused. */
+void A_outputv(const struct msgvec *iov, int iovcnt, void (*done)(void *), void *cookie)
+{
+  struct submission *sub;
+
+  sub = malloc(sizeof(struct submission) + iovcnt * sizeof(struct msgvec));
+  if (sub == NULL)
+  {
+    printf("memory allocation for submission failed.");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(sub->iov, iov, iovcnt * sizeof(struct msgvec));
+  sub->iovcnt = iovcnt;
+  sub->iovpos = 0;
+  sub->off = 0;
+  sub->done = done;
+  sub->cookie = cookie;
+  sub->next = NULL;
+  SkipEmpty(sub);
+  if (sub->iovpos == sub->iovcnt)
+  {
+    /* nothing to send: complete straight away */
+    free(sub);
+    if (done != NULL)
+      done(cookie);
+    return;
+  }
+
+  if (conn->A_ring == NULL)
+    conn->A_ring = GetRing();
+  if (conn->A_ring->subhead == NULL)
+    conn->A_ring->subhead = sub;
+  else
+    conn->A_ring->subtail->next = sub;
+  conn->A_ring->subtail = sub;
+  if (conn->A_ring->subnext == NULL)
+    conn->A_ring->subnext = sub;
+  Packetize();
+  TxPump();
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 /* A_output: Processes new messages from application layer and sends packets
  *
  * This function implements the core transmission logic of selective repeat:
- * 1. Calculates the current window boundaries (seqfirst to seqlast)
- * 2. Checks if next sequence number falls within the window:
+ * 1. Checks if next sequence number falls within the window starting at
+ *    A_baseseqnum (allowing for sequence number wraparound):
  *    - If within window: creates packet, assigns sequence number,
- *      calculates checksum, buffers packet, transmits to network layer,
- *      starts timer if it's the first packet, advances sequence counter
+ *      calculates checksum, stores it in the window slot for its
+ *      sequence number (attaching a ring if the window was empty),
+ *      queues it as new data for the transmit scheduler, advances
+ *      sequence counter
  *    - If window full: increments blocked message counter
- * 3. Handles sequence number wraparound in both window calculations
- *    and next sequence number assignment
  */
 void A_output(struct msg message)
 {
   struct pkt sendpkt;
   int i;
-  int index;
-  int seqfirst = A_baseseqnum;
-  int seqlast = (A_baseseqnum + WINDOWSIZE - 1) % SEQSPACE;
 
   /* if the A_nextseqnum is inside the window */
-  if (((seqfirst <= seqlast) && (A_nextseqnum >= seqfirst && A_nextseqnum <= seqlast)) ||
-      ((seqfirst > seqlast) && (A_nextseqnum >= seqfirst || A_nextseqnum <= seqlast)))
+  if (InWindow(conn->A_baseseqnum, conn->A_nextseqnum))
   {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
+    /* create packet and put it in the window */
     for (i = 0; i < 20; i++)
       sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* put packet in window buffer */
-    if (A_nextseqnum >= seqfirst)
-      index = A_nextseqnum - seqfirst;
-    else
-      index = WINDOWSIZE - seqfirst + A_nextseqnum;
-    buffer[index] = sendpkt;
-    windowcount++;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
-
-    /* start timer if first packet in window */
-    if (A_nextseqnum == seqfirst)
-      starttimer(A, RTT);
-
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    WindowAdd(&sendpkt);
+    TxPump();
   }
   /* if blocked, window is full */
   else
   {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    stat_add(STAT_WINDOW_FULL, 1);
   }
 }
 
@@ -133,54 +616,49 @@ void A_output(struct msg message)
  *
  * This function processes incoming ACK packets and manages the sliding window:
  * 1. Verifies packet integrity using checksum
- * 2. For valid ACKs within the current window:
+ * 2. For valid ACKs of packets that have been sent and are in the window:
  *    - Detects and handles duplicate ACKs
- *    - Marks new ACKs in the buffer and decrements window count
+ *    - Marks new ACKs in the window header state and decrements window count,
+ *      taking the packet off any transmit queue it is waiting in
  *    - For ACKs of the base packet (oldest unacknowledged):
- *      > Counts consecutive ACKs in buffer
- *      > Slides window forward accordingly
- *      > Updates buffer by shifting packets
+ *      > Slides the window over every consecutive ACKed slot, freeing them
+ *        and completing the submissions whose last packet they held
  *      > Manages timer (stops and restarts if needed)
- *    - For ACKs of other packets, updates buffer without sliding window
- * 3. Handles wraparound sequence numbers with proper window boundary calculations
+ *      > Packetizes submitted data into the room made
+ *      > Gives the ring back if the window is now empty
+ * Only the header state is touched; packets never move.  Completions
+ * are called last, when the sender is in a consistent state again.
  */
-
 void A_input(struct pkt packet)
 {
-  int ackcount = 0;
-  int i;
-  int seqfirst;
-  int seqlast;
+  struct ring *r = conn->A_ring;
+  struct submission *done = NULL, **donetail = &done, *sub;
   int index;
+
   /* if received ACK is not corrupted */
   if (IsCorrupted(packet) == -1)
   {
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
+    stat_add(STAT_ACKS_RECEIVED, 1);
 
-    /* need to check if new ACK or duplicate */
-    seqfirst = A_baseseqnum;
-    seqlast = (A_baseseqnum + WINDOWSIZE - 1) % SEQSPACE;
-
-    /* check case when seqnum has and hasn't wrapped */
-    if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-        ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast)))
+    /* need to check the ACK is for a packet in flight, and if new or duplicate */
+    if (packet.acknum >= 0 && packet.acknum < SEQSPACE &&
+        SeqOffset(conn->A_baseseqnum, packet.acknum) < SeqOffset(conn->A_baseseqnum, conn->A_nextseqnum))
     {
-      /* check coresponding position in window buffer */
-      if (packet.acknum >= seqfirst)
-        index = packet.acknum - seqfirst;
-      else
-        index = WINDOWSIZE - seqfirst + packet.acknum;
+      index = packet.acknum % WINDOWSIZE;
 
-      if (buffer[index].acknum == NOTINUSE)
+      if (!r->slot[index].acked)
       {
         /* packet is a new ACK */
         if (TRACE > 0)
           printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-        new_ACKs++;
-        windowcount--;
-        buffer[index].acknum = packet.acknum;
+        stat_add(STAT_NEW_ACKS, 1);
+        conn->windowcount--;
+        conn->A_timeouts = 0;
+        r->slot[index].acked = true;
+        TxDequeue(index);
+        tracecounter(A, "window", conn->windowcount);
       }
       else
       {
@@ -188,36 +666,44 @@ void A_input(struct pkt packet)
           printf("----A: duplicate ACK received, do nothing!\n");
       }
       /* check if it is the first one*/
-      if (packet.acknum == seqfirst)
+      if (packet.acknum == conn->A_baseseqnum)
       {
-        /* check how many concsecutive acks received in buffer */
-        for (i = 0; i < WINDOWSIZE; i++)
+        /* slide window over all consecutive ACKed packets */
+        while (r->slot[conn->A_baseseqnum % WINDOWSIZE].inuse && r->slot[conn->A_baseseqnum % WINDOWSIZE].acked)
         {
-          if (buffer[i].acknum != NOTINUSE && strcmp(buffer[i].payload, "") != 0)
-            ackcount++;
-          else
-            break;
+          index = conn->A_baseseqnum % WINDOWSIZE;
+          r->slot[index].inuse = false;
+          pb_put(r->u.buf[index]);
+          if (r->slot[index].endsub)
+          {
+            /* submissions end in order, so this is the oldest */
+            sub = r->subhead;
+            r->subhead = sub->next;
+            sub->next = NULL;
+            *donetail = sub;
+            donetail = &sub->next;
+          }
+          conn->A_baseseqnum = (conn->A_baseseqnum + 1) % SEQSPACE;
         }
 
-        /* slide window */
-        A_baseseqnum = (A_baseseqnum + ackcount) % SEQSPACE;
-
-        /* update buffer */
-        for (i = 0; i < WINDOWSIZE; i++)
+        /* the new base gets a full RTT (from when it is sent, if it has not
+           been yet); the running timer catches up lazily */
+        if (conn->windowcount > 0 && r->slot[conn->A_baseseqnum % WINDOWSIZE].queued != 'n')
         {
-          if (buffer[i + ackcount].acknum == NOTINUSE || (buffer[i].seqnum + ackcount) % SEQSPACE == A_nextseqnum)
-            buffer[i] = buffer[i + ackcount];
+          conn->A_deadline = get_sim_time() + RTT;
+          ArmTimer();
         }
 
-        /* restart timer */
-        stoptimer(A);
-        if (windowcount > 0)
-          starttimer(A, RTT);
-      }
-      else
-      {
-        /* update buffer */
-        buffer[index].acknum = packet.acknum;
+        /* fill the room made with submitted data */
+        Packetize();
+        TxPump();
+
+        /* nothing left in flight: the connection goes idle */
+        if (conn->A_baseseqnum == conn->A_nextseqnum && r->subhead == NULL)
+        {
+          PutRing(r);
+          conn->A_ring = NULL;
+        }
       }
     }
   }
@@ -226,20 +712,38 @@ void A_input(struct pkt packet)
     if (TRACE > 0)
       printf("----A: corrupted ACK is received, do nothing!\n");
   }
+
+  Complete(done, false);
 }
 
 /* called when A's timer goes off */
 /* When it is necessary to resend a packet, the oldest unacknowledged packet should be resent*/
 void A_timerinterrupt(void)
 {
-  if (TRACE > 0)
+  int index = conn->A_baseseqnum % WINDOWSIZE;
+
+  conn->A_timerrunning = false;
+  /* nothing outstanding, or the base has not gone out yet (it starts the
+     timer when it does): let the timer lapse */
+  if (conn->windowcount == 0 || conn->A_ring->slot[index].queued == 'n')
+    return;
+  /* the deadline moved on since the timer was armed: re-arm for it */
+  if (get_sim_time() + TIMER_SLACK < conn->A_deadline)
   {
-    printf("----A: time out,resend packets!\n");
-    printf("---A: resending packet %d\n", (buffer[0]).seqnum);
+    ArmTimer();
+    return;
   }
-  tolayer3(A, buffer[0]);
-  packets_resent++;
-  starttimer(A, RTT);
+
+  if (TRACE > 0)
+    printf("----A: time out,resend packets!\n");
+  /* a repeated timeout is a probe; a packet already queued stays put */
+  if (conn->A_ring->slot[index].queued == 0)
+    TxQueue(index, conn->A_timeouts > 0 ? 'p' : 'r');
+  if (conn->A_timeouts < 255)
+    conn->A_timeouts++;
+  conn->A_deadline = get_sim_time() + RTT;
+  ArmTimer();
+  TxPump();
 }
 
 /* the following routine will be called once (only) before any other */
@@ -247,53 +751,118 @@ void A_timerinterrupt(void)
 /* Initialize sender A's state variables */
 void A_init(void)
 {
-  A_baseseqnum = 0;
-  A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
-  windowcount = 0;
+  struct submission *cancelled = NULL;
+
+  conn->A_baseseqnum = 0;
+  conn->A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
+  conn->windowcount = 0;
+  conn->A_timerrunning = false;
+  conn->A_txnext = 0.0;
+  /* starting afresh: whatever pacing events were pending went with the
+     rest of the event list (see benchsetup() in emulator.c) */
+  conn->A_txscheduled = false;
+  conn->A_txevents = 0;
+  conn->A_timeouts = 0;
+  if (TXRATE > 0.0 && txevent < 0)
+    txevent = registerevent("txpace", TxEvent);
+  if (conn->A_ring != NULL)
+  {
+    PutSent(conn->A_ring);
+    cancelled = PutRing(conn->A_ring);
+    conn->A_ring = NULL;
+  }
+  Complete(cancelled, true);
 }
 
 /********* Receiver (B)  variables and procedures ************/
 
-static struct pkt B_buffer[WINDOWSIZE]; /* array for storing packets waiting for packet from A */
-static int B_baseseqnum;                /* first sequence number of the receiver's window */
-static int receivelast;                 /* record the last packet received position */
-
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 /* B_input: Handles data packets received from sender A
  *
  * This function implements receiver-side selective repeat protocol logic:
  * 1. Verifies packet integrity using checksum
  * 2. For valid packets:
- *    - Immediately generates and sends ACK with matching sequence number
- *    - Determines if packet falls within current receive window
- *    - For in-window packets:
- *      > Calculates appropriate buffer position
- *      > Tracks the furthest received packet position
- *      > Checks for and handles duplicate packets
- *      > For packets at window base:
- *        - Counts consecutive received packets
- *        - Slides window forward accordingly
- *        - Updates buffer by shifting packets
- *      > Delivers valid packet data to application layer
+ *    - Packets from before the window were delivered already; their ACK
+ *      was lost, so ACK them again
+ *    - For new in-window packets (if the application has room for
+ *      everything that is buffered plus this packet):
+ *      > The packet at the window base is delivered straight away,
+ *        followed by any consecutive packets buffered after it, and the
+ *        window slides past them
+ *      > Others are stored in the slot for their sequence number (a
+ *        ring is attached for them first if there is none)
+ *      > Either way the packet is ACKed
+ *    - Duplicate in-window packets are ACKed again
  * 3. Properly handles sequence number wraparound in window calculations
  *
  * The implementation follows selective repeat by accepting out-of-order
  * packets while still maintaining ordered delivery to the application.
+ * Packets arriving in order never need the ring.
  */
 void B_input(struct pkt packet)
 {
-  int pckcount = 0;
   struct pkt sendpkt;
+  struct ring *r = conn->B_ring;
   int i;
-  int seqfirst;
-  int seqlast;
   int index;
+
   /* if received packet is not corrupted */
-  if (IsCorrupted(packet) == -1)
+  if (IsCorrupted(packet) == -1 && packet.seqnum >= 0 && packet.seqnum < SEQSPACE)
   {
+    /* need to check if new packet or duplicate */
+    if (InWindow(conn->B_baseseqnum, packet.seqnum))
+    {
+      index = packet.seqnum % WINDOWSIZE;
+
+      if (r == NULL || !r->slot[index].inuse)
+      {
+        /* the application cannot take any more data: do not accept (or ACK)
+           the packet, the sender will retransmit it once it catches up */
+        if (tolayer5_space(B) <= conn->B_buffered)
+        {
+          if (TRACE > 0)
+            printf("----B: application buffer full, packet %d not accepted\n", packet.seqnum);
+          return;
+        }
+        stat_add(STAT_PACKETS_RECEIVED, 1);
+
+        if (packet.seqnum == conn->B_baseseqnum)
+        {
+          /* the base: deliver it, then everything that is now in order */
+          tolayer5(B, packet.payload);
+          conn->B_baseseqnum = (conn->B_baseseqnum + 1) % SEQSPACE;
+          while (r != NULL && r->slot[conn->B_baseseqnum % WINDOWSIZE].inuse)
+          {
+            index = conn->B_baseseqnum % WINDOWSIZE;
+            tolayer5(B, r->u.payload[index]);
+            r->slot[index].inuse = false;
+            conn->B_buffered--;
+            conn->B_baseseqnum = (conn->B_baseseqnum + 1) % SEQSPACE;
+          }
+          if (r != NULL && conn->B_buffered == 0)
+          {
+            PutRing(r);
+            conn->B_ring = NULL;
+          }
+        }
+        else
+        {
+          /* out of order: buffer it */
+          if (r == NULL)
+            r = conn->B_ring = GetRing();
+          r->slot[index].seqnum = packet.seqnum;
+          r->slot[index].inuse = true;
+          memcpy(r->u.payload[index], packet.payload, 20);
+          conn->B_buffered++;
+        }
+      }
+    }
+    /* not in the window and not from the window before it: ignore */
+    else if (!InWindow((conn->B_baseseqnum - WINDOWSIZE + SEQSPACE) % SEQSPACE, packet.seqnum))
+      return;
+
     if (TRACE > 0)
       printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
-    packets_received++;
     /*create sendpkt*/
     /* send an ACK for the received packet */
     sendpkt.acknum = packet.seqnum;
@@ -305,53 +874,6 @@ void B_input(struct pkt packet)
     sendpkt.checksum = ComputeChecksum(sendpkt);
     /*send ack*/
     tolayer3(B, sendpkt);
-    /* need to check if new packet or duplicate */
-    seqfirst = B_baseseqnum;
-    seqlast = (B_baseseqnum + WINDOWSIZE - 1) % SEQSPACE;
-
-    /*see if the packet received is inside the window*/
-    if (((seqfirst <= seqlast) && (packet.seqnum >= seqfirst && packet.seqnum <= seqlast)) ||
-        ((seqfirst > seqlast) && (packet.seqnum >= seqfirst || packet.seqnum <= seqlast)))
-    {
-
-      /*get index*/
-      if (packet.seqnum >= seqfirst)
-        index = packet.seqnum - seqfirst;
-      else
-        index = WINDOWSIZE - seqfirst + packet.seqnum;
-      /*keep receivelast */
-      receivelast = receivelast > index ? receivelast : index;
-
-      /*if not duplicate, save to buffer*/
-
-      if (strcmp(B_buffer[index].payload, packet.payload) != 0)
-      {
-        /*buffer it*/
-        packet.acknum = packet.seqnum;
-        B_buffer[index] = packet;
-        /*if it is the base*/
-        if (packet.seqnum == seqfirst)
-        {
-          for (i = 0; i < WINDOWSIZE; i++)
-          {
-            if (B_buffer[i].acknum >= 0 && strcmp(B_buffer[i].payload, "") != 0)
-              pckcount++;
-            else
-              break;
-          }
-          /* update state variables */
-          B_baseseqnum = (B_baseseqnum + pckcount) % SEQSPACE;
-          /*update buffer*/
-          for (i = 0; i < WINDOWSIZE; i++)
-          {
-            if ((i + pckcount) <= (receivelast + 1))
-              B_buffer[i] = B_buffer[i + pckcount];
-          }
-        }
-        /* deliver to receiving application */
-        tolayer5(B, packet.payload);
-      }
-    }
   }
 }
 
@@ -360,8 +882,13 @@ void B_input(struct pkt packet)
 void B_init(void)
 {
   /* initialise B's window, buffer and sequence number */
-  B_baseseqnum = 0; /*record the first seq num of the window*/
-  receivelast = -1;
+  conn->B_baseseqnum = 0; /*record the first seq num of the window*/
+  conn->B_buffered = 0;
+  if (conn->B_ring != NULL)
+  {
+    PutRing(conn->B_ring);
+    conn->B_ring = NULL;
+  }
 }
 
 /******************************************************************************
@@ -371,9 +898,151 @@ void B_init(void)
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
 void B_output(struct msg message)
 {
+  (void)message;
 }
 
 /* called when B's timer goes off */
 void B_timerinterrupt(void)
 {
 }
+
+#ifdef SR_CONNBENCH
+/* memory per connection at a million connections, and the cost of
+   sending a packet with a full window:
+     cc -O2 -DSR_CONNBENCH [-DWINDOWSIZE=1024] -o srconn sr.c stats.c pktbuf.c
+   The emulator is replaced by stubs that just keep the last packet sent. */
+#include <time.h>
+
+int TRACE = 0;
+static struct pkt lastpkt;
+static long delivered;
+
+void tolayer3(int AorB, struct pkt packet) { (void)AorB; lastpkt = packet; }
+void tolayer3_buf(int AorB, struct pktbuf *buf) { (void)AorB; lastpkt = buf->pkt; }
+void tolayer5(int AorB, char data[20]) { (void)AorB; (void)data; delivered++; }
+int tolayer5_space(int AorB) { (void)AorB; return WINDOWSIZE; }
+void starttimer(int AorB, double increment) { (void)AorB; (void)increment; }
+void stoptimer(int AorB) { (void)AorB; }
+float get_sim_time(void) { return 0.0; }
+void tracecounter(int AorB, const char *name, double value) { (void)AorB; (void)name; (void)value; }
+int registerevent(const char *name, eventhandler handler) { (void)name; (void)handler; return 0; }
+void scheduleevent(int type, int AorB, double delay, void *payload) { (void)type; (void)AorB; (void)delay; (void)payload; }
+
+/* resident memory in bytes, 0 if unknown */
+static double resident(void)
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  long size, rss = 0;
+
+  if (f == NULL)
+    return 0.0;
+  if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+    rss = 0;
+  fclose(f);
+  return (double)rss * 4096;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+  long n = argc > 1 ? atol(argv[1]) : 1000000;
+  long active = n / 100, i, rings = 0;
+  struct srconn **conns = malloc(n * sizeof(struct srconn *));
+  struct ring *r;
+  struct msg message;
+  struct pkt packet;
+  double rss0, rss1, rss2, t0;
+  long rounds, k, j, seq;
+
+  if (conns == NULL)
+    return 1;
+  memset(message.data, 'a', 20);
+  rss0 = resident();
+  for (i = 0; i < n; i++)
+    conns[i] = sr_newconn();
+  rss1 = resident();
+
+  /* 1% become active: a packet in flight from A, one out of order at B */
+  t0 = now();
+  for (i = 0; i < active; i++)
+  {
+    sr_select(conns[i]);
+    A_output(message);
+    packet = lastpkt;
+    packet.seqnum = 1;
+    packet.checksum = ComputeChecksum(packet);
+    B_input(packet);
+  }
+  rss2 = resident();
+
+  /* and go idle again: the missing packet arrives, then the ACK */
+  for (i = 0; i < active; i++)
+  {
+    sr_select(conns[i]);
+    A_output(message);             /* seqnum 1, into the window */
+    A_output(message);             /* seqnum 2 */
+    packet = lastpkt;
+    packet.seqnum = 0;
+    packet.checksum = ComputeChecksum(packet);
+    B_input(packet);               /* delivers 0 and the buffered 1 */
+    for (packet.acknum = 0; packet.acknum < 3; packet.acknum++)
+    {
+      packet.seqnum = NOTINUSE;
+      packet.checksum = ComputeChecksum(packet);
+      A_input(packet);
+    }
+    packet.seqnum = 2;
+    packet.acknum = NOTINUSE;
+    packet.checksum = ComputeChecksum(packet);
+    B_input(packet);
+  }
+  t0 = now() - t0;
+  for (i = 0; i < n; i++)
+    if (conns[i]->A_ring != NULL || conns[i]->B_ring != NULL)
+      break;
+  for (r = freerings; r != NULL; r = r->next)
+    rings++;
+
+  printf("%ld connections, %ld of them made active and idle again\n", n, active);
+  printf("connection state: %d bytes idle, %d bytes active (%d byte ring each way)\n",
+         (int)sizeof(struct srconn), (int)(sizeof(struct srconn) + 2 * sizeof(struct ring)),
+         (int)sizeof(struct ring));
+  if (rss0 > 0.0)
+    printf("resident: %.1f bytes per idle connection, %.1f more per active one\n",
+           (rss1 - rss0) / n, active > 0 ? (rss2 - rss1) / active : 0.0);
+  printf("%.0f ns per activate/deactivate cycle, %ld deliveries, %ld rings pooled, %s\n",
+         active > 0 ? t0 * 1e9 / active : 0.0, delivered, rings,
+         i == n ? "all connections idle" : "SOME CONNECTIONS STILL HOLD RINGS");
+
+  /* fill the window of a fresh connection, ACK it all in order, repeat:
+     every packet is sent with the window as full as it gets */
+  sr_select(sr_newconn());
+  rounds = 4000000 / WINDOWSIZE + 1;
+  seq = 0;
+  t0 = now();
+  for (k = 0; k < rounds; k++)
+  {
+    for (j = 0; j < WINDOWSIZE; j++)
+      A_output(message);
+    for (j = 0; j < WINDOWSIZE; j++)
+    {
+      packet.seqnum = NOTINUSE;
+      packet.acknum = (int)(seq++ % SEQSPACE);
+      memset(packet.payload, '0', 20);
+      packet.checksum = ComputeChecksum(packet);
+      A_input(packet);
+    }
+  }
+  t0 = now() - t0;
+  printf("%.1f ns per packet sent and ACKed, window of %d, policy %s\n",
+         t0 * 1e9 / (rounds * WINDOWSIZE), WINDOWSIZE, TXPOLICY);
+  return i != n || delivered != 3 * active || conn->A_ring != NULL;
+}
+#endif
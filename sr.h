@@ -1,11 +1,40 @@
+#include <stddef.h>
+
 extern void A_init(void);
 extern void B_init(void);
 extern void A_input(struct pkt);
 extern void B_input(struct pkt);
 extern void A_output(struct msg);
+
+/* scatter/gather output: send the bytes of the buffers (base, len) of
+   an array of iovcnt as a stream of packets, the last padded with zeros.
+   The buffers are not copied until they are packetized, so they must
+   not change until done(cookie) is called, which happens once all of the
+   data has been acknowledged (done may be NULL), or when the connection
+   is reset by A_init() or freed with the data not all sent; during done
+   sr_cancelled() tells which. */
+struct msgvec {
+  const char *base;
+  size_t len;
+};
+extern void A_outputv(const struct msgvec *, int, void (*)(void *), void *);
+extern int sr_cancelled(void);
+
 extern void A_timerinterrupt(void);
 
+/* which protocol this is, its window and timeout, for labelling results */
+extern const char protocol_name[];
+extern const int protocol_window;
+extern const double protocol_rtt;
+
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
 extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void B_timerinterrupt(void);
+
+/* many connections in one module: the A_ and B_ routines act on the
+   connection selected last (there is one selected to start with) */
+struct srconn;
+extern struct srconn *sr_newconn(void);
+extern void sr_freeconn(struct srconn *);
+extern void sr_select(struct srconn *);
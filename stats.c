@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200112L   /* posix_memalign() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+/* ******************************************************************
+   Sharded statistics: see stats.h.
+**********************************************************************/
+
+#define CACHELINE 64
+
+struct statshard {
+  long counter[STAT_NCOUNTERS];
+  struct histogram hist[STAT_NHISTS];
+  struct statshard *next;    /* all shards, newest first */
+};
+
+/* Each shard is written by its own thread only, so an update is a load
+   and a store, not a read-modify-write; they are made atomic (relaxed)
+   just so that readers on other threads never see a torn value.
+   Without GCC-style builtins and thread-local storage there is a single
+   shard and statistics may only be updated from one thread. */
+#ifdef __GNUC__
+#define LOAD(p)        __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define LOADD(p, v)    __atomic_load((p), (v), __ATOMIC_RELAXED)
+#define STORED(p, v)   __atomic_store((p), (v), __ATOMIC_RELAXED)
+static __thread struct statshard *myshard;
+#else
+#define LOAD(p)        (*(p))
+#define STORE(p, v)    (*(p) = (v))
+#define LOADD(p, v)    (*(v) = *(p))
+#define STORED(p, v)   (*(p) = *(v))
+static struct statshard *myshard;
+#endif
+
+static struct statshard *shards;  /* list of every thread's shard */
+
+/* the calling thread's shard, created on first use */
+static struct statshard *shard(void)
+{
+  struct statshard *s = myshard;
+  void *mem;
+  size_t size;
+
+  if (s != NULL)
+    return s;
+  /* whole cache lines, so no two threads' shards share one */
+  size = (sizeof(struct statshard) + CACHELINE - 1) / CACHELINE * CACHELINE;
+  if (posix_memalign(&mem, CACHELINE, size) != 0) {
+    printf("memory allocation for statistics failed.");
+    exit(EXIT_FAILURE);
+  }
+  s = mem;
+  memset(s, 0, size);
+#ifdef __GNUC__
+  s->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&shards, &s->next, s, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+#else
+  s->next = shards;
+  shards = s;
+#endif
+  myshard = s;
+  return s;
+}
+
+static struct statshard *firstshard(void)
+{
+#ifdef __GNUC__
+  return __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+#else
+  return shards;
+#endif
+}
+
+void stat_add(enum statcounter c, long n)
+{
+  struct statshard *s = shard();
+
+  STORE(&s->counter[c], LOAD(&s->counter[c]) + n);
+}
+
+long stat_read(enum statcounter c)
+{
+  struct statshard *s;
+  long sum = 0;
+
+  for (s = firstshard(); s != NULL; s = s->next)
+    sum += LOAD(&s->counter[c]);
+  return sum;
+}
+
+void stat_record(enum stathist h, double value)
+{
+  struct histogram *hist = &shard()->hist[h];
+  double x, limit;
+  int b;
+
+  for (b = 0, limit = 1.0; b < STAT_NBUCKETS - 1 && value >= limit; b++)
+    limit *= 2;
+  STORE(&hist->bucket[b], LOAD(&hist->bucket[b]) + 1);
+  STORE(&hist->count, LOAD(&hist->count) + 1);
+  LOADD(&hist->sum, &x);
+  x += value;
+  STORED(&hist->sum, &x);
+  LOADD(&hist->max, &x);
+  if (value > x)
+    STORED(&hist->max, &value);
+}
+
+void stat_histogram(enum stathist h, struct histogram *out)
+{
+  struct statshard *s;
+  double x;
+  int b;
+
+  memset(out, 0, sizeof(*out));
+  for (s = firstshard(); s != NULL; s = s->next) {
+    out->count += LOAD(&s->hist[h].count);
+    LOADD(&s->hist[h].sum, &x);
+    out->sum += x;
+    LOADD(&s->hist[h].max, &x);
+    if (x > out->max)
+      out->max = x;
+    for (b = 0; b < STAT_NBUCKETS; b++)
+      out->bucket[b] += LOAD(&s->hist[h].bucket[b]);
+  }
+}
+
+double stat_percentile(const struct histogram *hist, double p)
+{
+  double limit = 1.0;
+  long seen = 0;
+  int b;
+
+  for (b = 0; b < STAT_NBUCKETS - 1; b++, limit *= 2) {
+    seen += hist->bucket[b];
+    if (seen >= p * hist->count)
+      return limit;
+  }
+  return hist->max;
+}
+
+void stat_reset(void)
+{
+  struct statshard *s;
+
+  for (s = firstshard(); s != NULL; s = s->next) {
+    memset(s->counter, 0, sizeof(s->counter));
+    memset(s->hist, 0, sizeof(s->hist));
+  }
+}
@@ -0,0 +1,65 @@
+/* ******************************************************************
+   Statistics counters and histograms.
+
+   Every thread that updates statistics gets a shard of its own, padded
+   out to whole cache lines, the first time it does so; updates go to the
+   thread's shard only, so they need no locks or atomic read-modify-write
+   and threads never contend for a cache line.  Reads merge all shards:
+   counters are summed, histograms summed bucket by bucket.  Each shard
+   has a single writer and is written with relaxed atomic stores, so a
+   read while other threads are counting is safe and sees every update
+   up to some recent point.  Shards are never freed, so the counts of a
+   thread that has finished stay in the totals.
+
+   Histograms have power of two buckets: bucket 0 counts values below 1,
+   bucket b values in [2^(b-1), 2^b), and the last bucket everything
+   larger.  The caller picks the unit.
+**********************************************************************/
+#ifndef STATS_H
+#define STATS_H
+
+enum statcounter {
+  STAT_WINDOW_FULL,          /* messages dropped due to full window */
+  STAT_ACKS_RECEIVED,        /* uncorrupted ACKs received at A */
+  STAT_NEW_ACKS,             /* ACKs that acknowledged something new */
+  STAT_PACKETS_RESENT,       /* packets resent by A */
+  STAT_PACKETS_RECEIVED,     /* correct packets received at B */
+  STAT_MESSAGES_DELIVERED,   /* messages delivered to the application */
+  STAT_NCOUNTERS
+};
+
+enum stathist {
+  HIST_PACE_LAG,             /* real-time pacing: lag behind the wall clock, in us */
+  HIST_FRAG_LATENCY,         /* fragmented messages: send to reassembly, in time units */
+  STAT_NHISTS
+};
+
+#define STAT_NBUCKETS 32
+
+struct histogram {
+  long count;                /* values recorded */
+  double sum;                /* their total */
+  double max;                /* the largest */
+  long bucket[STAT_NBUCKETS];
+};
+
+/* add n to a counter */
+extern void stat_add(enum statcounter, long n);
+
+/* a counter's total over all threads */
+extern long stat_read(enum statcounter);
+
+/* record a value in a histogram */
+extern void stat_record(enum stathist, double value);
+
+/* a histogram merged over all threads */
+extern void stat_histogram(enum stathist, struct histogram *);
+
+/* upper bound of the bucket holding fraction p (0 to 1) of the values of
+   a histogram; the largest value for the last bucket */
+extern double stat_percentile(const struct histogram *, double p);
+
+/* zero everything; only while no other thread is updating statistics */
+extern void stat_reset(void);
+
+#endif
@@ -0,0 +1,579 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+/* ******************************************************************
+   Compressed, time indexed event traces: see trace.h.
+**********************************************************************/
+
+#define TRACE_MAGIC  "ETRACE1\n"
+#define INDEX_MAGIC  "ETINDEX\n"
+#define BLK_MAGIC    0x4b4c4254u    /* "TBLK" */
+#define MAXREC       32             /* longest encoded record */
+#define TIMESCALE    1e6            /* stored time units per time unit */
+#define PAD8(n)      ((8 - (n) % 8) % 8)
+
+struct blockhdr {
+  uint32_t magic;
+  uint32_t nrecs;
+  uint32_t rawlen;
+  uint32_t complen;          /* equal to rawlen if stored uncompressed */
+  uint64_t first;            /* time of the first record */
+};
+
+struct trailer {
+  uint64_t indexoff;
+  uint32_t nblocks;
+  uint32_t ntypes;
+  char magic[8];
+};
+
+struct tracewriter {
+  FILE *f;
+  uint64_t offset;           /* file position */
+  unsigned char raw[TRACE_BLOCKRAW];
+  unsigned char comp[TRACE_BLOCKRAW + TRACE_BLOCKRAW / 255 + 16];
+  size_t len;                /* of raw */
+  struct blockhdr hdr;       /* of the block in raw */
+  uint64_t prevtime;
+  int prevseq[2], prevack[2];
+  struct traceindex *index;
+  int nblocks, maxblocks;
+  int error;
+};
+
+/********* varints ************/
+
+static unsigned char *putvarint(unsigned char *p, uint64_t x)
+{
+  while (x >= 0x80) {
+    *p++ = (unsigned char)(x | 0x80);
+    x >>= 7;
+  }
+  *p++ = (unsigned char)x;
+  return p;
+}
+
+static uint64_t zigzag(int64_t x)
+{
+  return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+static int64_t unzigzag(uint64_t x)
+{
+  return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+/* the varint at *p (before end); 0 if it runs off the end */
+static int getvarint(const unsigned char **p, const unsigned char *end, uint64_t *x)
+{
+  int shift = 0;
+
+  *x = 0;
+  while (*p < end && shift < 64) {
+    *x |= (uint64_t)(**p & 0x7f) << shift;
+    if ((*(*p)++ & 0x80) == 0)
+      return 1;
+    shift += 7;
+  }
+  return 0;
+}
+
+/********* block compression ************/
+
+/* LZ77 with a hash of the next 4 bytes finding earlier occurrences up to
+   64K back.  A compressed block is a series of sequences, each a token
+   byte (literal count in the high nibble, match length - 4 in the low,
+   15 meaning more follows in bytes of 255 and a last one below 255),
+   the literals, and a 2 byte offset back to the match.  The last
+   sequence has literals only. */
+
+#define LZ_MINMATCH 4
+#define LZ_HASHBITS 13
+
+static uint32_t read32(const unsigned char *p)
+{
+  uint32_t x;
+
+  memcpy(&x, p, 4);
+  return x;
+}
+
+static unsigned char *putlength(unsigned char *p, size_t n)
+{
+  for (; n >= 255; n -= 255)
+    *p++ = 255;
+  *p++ = (unsigned char)n;
+  return p;
+}
+
+static unsigned char *sequence(unsigned char *op, const unsigned char *lit, size_t nlit,
+                               size_t offset, size_t mlen)
+{
+  unsigned char *token = op++;
+
+  *token = (unsigned char)((nlit >= 15 ? 15 : nlit) << 4);
+  if (nlit >= 15)
+    op = putlength(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (mlen > 0) {
+    mlen -= LZ_MINMATCH;
+    *token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    if (mlen >= 15)
+      op = putlength(op, mlen - 15);
+  }
+  return op;
+}
+
+/* compress n bytes of in into out, which has room for n + n / 255 + 16;
+   returns the compressed length */
+static size_t lz_compress(const unsigned char *in, size_t n, unsigned char *out)
+{
+  static uint32_t table[1 << LZ_HASHBITS];    /* position + 1 of the last occurrence */
+  unsigned char *op = out;
+  size_t ip = 0, anchor = 0, ref, len;
+  uint32_t h;
+
+  memset(table, 0, sizeof(table));
+  while (ip + LZ_MINMATCH <= n) {
+    h = (read32(in + ip) * 2654435761u) >> (32 - LZ_HASHBITS);
+    ref = table[h];
+    table[h] = (uint32_t)ip + 1;
+    if (ref-- == 0 || ip - ref > 65535 || read32(in + ref) != read32(in + ip)) {
+      ip++;
+      continue;
+    }
+    for (len = LZ_MINMATCH; ip + len < n && in[ref + len] == in[ip + len]; len++)
+      ;
+    op = sequence(op, in + anchor, ip - anchor, ip - ref, len);
+    ip += len;
+    anchor = ip;
+  }
+  return (size_t)(sequence(op, in + anchor, n - anchor, 0, 0) - out);
+}
+
+static int getlength(const unsigned char **ip, const unsigned char *end, size_t *n)
+{
+  unsigned char b;
+
+  do {
+    if (*ip == end)
+      return 0;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return 1;
+}
+
+/* decompress n bytes of in into out, of cap bytes; returns the length,
+   or -1 if the data is damaged */
+static long lz_decompress(const unsigned char *in, size_t n, unsigned char *out, size_t cap)
+{
+  const unsigned char *ip = in, *end = in + n;
+  size_t op = 0, nlit, mlen, offset;
+  unsigned token;
+
+  while (ip < end) {
+    token = *ip++;
+    nlit = token >> 4;
+    if (nlit == 15 && !getlength(&ip, end, &nlit))
+      return -1;
+    if (nlit > (size_t)(end - ip) || nlit > cap - op)
+      return -1;
+    memcpy(out + op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == end)
+      break;
+    if (end - ip < 2)
+      return -1;
+    offset = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    mlen = token & 15;
+    if (mlen == 15 && !getlength(&ip, end, &mlen))
+      return -1;
+    mlen += LZ_MINMATCH;
+    if (offset == 0 || offset > op || mlen > cap - op)
+      return -1;
+    for (; mlen > 0; mlen--, op++)     /* byte by byte: the match may overlap */
+      out[op] = out[op - offset];
+  }
+  return (long)op;
+}
+
+/********* writing ************/
+
+static void put(struct tracewriter *w, const void *p, size_t n)
+{
+  if (fwrite(p, 1, n, w->f) != n)
+    w->error = 1;
+  w->offset += n;
+}
+
+struct tracewriter *trace_create(const char *file)
+{
+  struct tracewriter *w;
+
+  if ((w = calloc(1, sizeof(struct tracewriter))) == NULL) {
+    printf("memory allocation for event trace failed.");
+    exit(EXIT_FAILURE);
+  }
+  if ((w->f = fopen(file, "wb")) == NULL) {
+    printf("unable to open event trace file %s\n", file);
+    free(w);
+    return NULL;
+  }
+  put(w, TRACE_MAGIC, 8);
+  return w;
+}
+
+static void flush(struct tracewriter *w)
+{
+  struct traceindex *ix;
+  size_t complen;
+
+  if (w->hdr.nrecs == 0)
+    return;
+  if (w->nblocks == w->maxblocks) {
+    w->maxblocks = w->maxblocks ? 2 * w->maxblocks : 256;
+    if ((w->index = realloc(w->index, w->maxblocks * sizeof(struct traceindex))) == NULL) {
+      printf("memory allocation for event trace failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  ix = &w->index[w->nblocks++];
+  ix->first = w->hdr.first;
+  ix->last = w->prevtime;
+  ix->offset = w->offset;
+  ix->nrecs = w->hdr.nrecs;
+  ix->pad = 0;
+
+  complen = lz_compress(w->raw, w->len, w->comp);
+  w->hdr.magic = BLK_MAGIC;
+  w->hdr.rawlen = (uint32_t)w->len;
+  w->hdr.complen = (uint32_t)(complen < w->len ? complen : w->len);
+  put(w, &w->hdr, sizeof(w->hdr));
+  put(w, complen < w->len ? w->comp : w->raw, w->hdr.complen);
+  put(w, "\0\0\0\0\0\0\0", PAD8(w->hdr.complen));   /* headers and index are read in place */
+  w->hdr.nrecs = 0;
+  w->len = 0;
+}
+
+void trace_add(struct tracewriter *w, const struct tracerec *r)
+{
+  uint64_t t = (uint64_t)(r->time * TIMESCALE + 0.5);
+  unsigned char *p;
+  int e = r->entity & 1;
+
+  if (w->len > TRACE_BLOCKRAW - MAXREC)
+    flush(w);
+  if (t < w->prevtime)
+    t = w->prevtime;
+  if (w->hdr.nrecs == 0) {     /* a block starts from scratch */
+    w->hdr.first = w->prevtime = t;
+    w->prevseq[0] = w->prevseq[1] = w->prevack[0] = w->prevack[1] = 0;
+  }
+  p = putvarint(w->raw + w->len, t - w->prevtime);
+  p = putvarint(p, (uint64_t)r->type << 2 | (uint64_t)e << 1 | (r->haspkt != 0));
+  if (r->haspkt) {
+    p = putvarint(p, zigzag((int64_t)r->seq - w->prevseq[e]));
+    p = putvarint(p, zigzag((int64_t)r->ack - w->prevack[e]));
+    w->prevseq[e] = r->seq;
+    w->prevack[e] = r->ack;
+  }
+  w->len = (size_t)(p - w->raw);
+  w->prevtime = t;
+  w->hdr.nrecs++;
+}
+
+long trace_finish(struct tracewriter *w, const char *const *names, int ntypes)
+{
+  struct trailer tr;
+  char name[TRACE_NAMELEN];
+  long size;
+  int i;
+
+  flush(w);
+  if (ntypes > TRACE_MAXTYPES)
+    ntypes = TRACE_MAXTYPES;
+  memset(&tr, 0, sizeof(tr));
+  tr.indexoff = w->offset;
+  tr.nblocks = (uint32_t)w->nblocks;
+  tr.ntypes = (uint32_t)ntypes;
+  memcpy(tr.magic, INDEX_MAGIC, 8);
+  put(w, w->index, w->nblocks * sizeof(struct traceindex));
+  for (i = 0; i < ntypes; i++) {
+    memset(name, 0, sizeof(name));
+    snprintf(name, sizeof(name), "%s", names[i]);
+    put(w, name, sizeof(name));
+  }
+  put(w, &tr, sizeof(tr));
+  size = (long)w->offset;
+  if (fclose(w->f) != 0 || w->error)
+    size = -1;
+  free(w->index);
+  free(w);
+  return size;
+}
+
+/********* reading ************/
+
+static const struct blockhdr *blockat(const struct tracefile *tf, uint64_t offset)
+{
+  const struct blockhdr *h = (const struct blockhdr *)(tf->base + offset);
+
+  if (offset + sizeof(struct blockhdr) > tf->size || h->magic != BLK_MAGIC || h->nrecs == 0 ||
+      h->rawlen > TRACE_BLOCKRAW || h->complen > h->rawlen ||
+      h->complen > tf->size - offset - sizeof(struct blockhdr))
+    return NULL;
+  return h;
+}
+
+/* index from the block headers, for a trace that was never finished;
+   the last times are not known and are left at the first */
+static int rebuildindex(struct tracefile *tf)
+{
+  const struct blockhdr *h;
+  uint64_t offset = 8;
+  int max = 0;
+
+  tf->nblocks = 0;
+  tf->index = NULL;
+  while ((h = blockat(tf, offset)) != NULL) {
+    if (tf->nblocks == max) {
+      max = max ? 2 * max : 256;
+      if ((tf->index = realloc(tf->index, max * sizeof(struct traceindex))) == NULL)
+        return -1;
+    }
+    tf->index[tf->nblocks].first = tf->index[tf->nblocks].last = h->first;
+    tf->index[tf->nblocks].offset = offset;
+    tf->index[tf->nblocks].nrecs = h->nrecs;
+    tf->nblocks++;
+    offset += sizeof(struct blockhdr) + h->complen + PAD8(h->complen);
+  }
+  tf->ownindex = 1;
+  return 0;
+}
+
+int trace_open(struct tracefile *tf, const char *file)
+{
+  const struct trailer *tr;
+  struct stat st;
+  void *base;
+  size_t tail;
+  int fd, i;
+
+  memset(tf, 0, sizeof(*tf));
+  if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    printf("event trace %s: %s\n", file, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  base = (size_t)st.st_size >= 8 ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (base == MAP_FAILED || memcmp(base, TRACE_MAGIC, 8) != 0) {
+    printf("event trace %s: not an event trace\n", file);
+    if (base != MAP_FAILED)
+      munmap(base, (size_t)st.st_size);
+    return -1;
+  }
+  tf->base = base;
+  tf->size = (size_t)st.st_size;
+  if ((tf->buf = malloc(TRACE_BLOCKRAW)) == NULL) {
+    printf("memory allocation for event trace failed.");
+    exit(EXIT_FAILURE);
+  }
+
+  tr = (const struct trailer *)(tf->base + tf->size - sizeof(struct trailer));
+  if (tf->size >= 8 + sizeof(struct trailer) && memcmp(tr->magic, INDEX_MAGIC, 8) == 0 &&
+      tr->indexoff % 8 == 0 &&
+      tr->ntypes <= TRACE_MAXTYPES && tr->indexoff <= tf->size - sizeof(struct trailer) &&
+      (tail = tf->size - sizeof(struct trailer) - tr->indexoff) ==
+      tr->nblocks * sizeof(struct traceindex) + tr->ntypes * TRACE_NAMELEN) {
+    /* finished: the index is used where it is */
+    tf->index = (struct traceindex *)(tf->base + tr->indexoff);
+    tf->nblocks = (int)tr->nblocks;
+    tf->ntypes = (int)tr->ntypes;
+    for (i = 0; i < tf->ntypes; i++) {
+      memcpy(tf->names[i], tf->base + tr->indexoff + tr->nblocks * sizeof(struct traceindex) + i * TRACE_NAMELEN,
+             TRACE_NAMELEN);
+      tf->names[i][TRACE_NAMELEN - 1] = '\0';
+    }
+  }
+  else if (rebuildindex(tf) < 0) {
+    printf("memory allocation for event trace failed.");
+    exit(EXIT_FAILURE);
+  }
+  tf->block = -1;
+  return 0;
+}
+
+void trace_unmap(struct tracefile *tf)
+{
+  if (tf->ownindex)
+    free(tf->index);
+  free(tf->buf);
+  munmap((void *)tf->base, tf->size);
+}
+
+/* decompress block b into the buffer; 0 if it is missing or damaged */
+static int loadblock(struct tracefile *tf, int b)
+{
+  const struct blockhdr *h;
+  long len;
+
+  tf->block = -1;
+  tf->len = tf->pos = 0;
+  if (b < 0 || b >= tf->nblocks || (h = blockat(tf, tf->index[b].offset)) == NULL)
+    return 0;
+  if (h->complen == h->rawlen) {
+    memcpy(tf->buf, h + 1, h->rawlen);
+    len = h->rawlen;
+  }
+  else if ((len = lz_decompress((const unsigned char *)(h + 1), h->complen, tf->buf, TRACE_BLOCKRAW)) != (long)h->rawlen)
+    return 0;
+  tf->decoded++;
+  tf->block = b;
+  tf->len = (size_t)len;
+  tf->prevtime = h->first;
+  tf->prevseq[0] = tf->prevseq[1] = tf->prevack[0] = tf->prevack[1] = 0;
+  return 1;
+}
+
+int trace_next(struct tracefile *tf, struct tracerec *r)
+{
+  const unsigned char *p, *end;
+  uint64_t dt, tag, ds, da;
+  int e;
+
+  while (tf->block < 0 || tf->pos == tf->len)
+    if (!loadblock(tf, tf->block < 0 ? 0 : tf->block + 1))
+      return 0;
+  p = tf->buf + tf->pos;
+  end = tf->buf + tf->len;
+  if (!getvarint(&p, end, &dt) || !getvarint(&p, end, &tag))
+    return 0;
+  e = (int)(tag >> 1) & 1;
+  r->type = (int)(tag >> 2);
+  r->entity = e;
+  r->haspkt = (int)(tag & 1);
+  r->seq = r->ack = -1;
+  if (r->haspkt) {
+    if (!getvarint(&p, end, &ds) || !getvarint(&p, end, &da))
+      return 0;
+    r->seq = tf->prevseq[e] = (int)(tf->prevseq[e] + unzigzag(ds));
+    r->ack = tf->prevack[e] = (int)(tf->prevack[e] + unzigzag(da));
+  }
+  tf->prevtime += dt;
+  r->time = tf->prevtime / TIMESCALE;
+  tf->pos = (size_t)(p - tf->buf);
+  return 1;
+}
+
+void trace_seek(struct tracefile *tf, double time)
+{
+  uint64_t t = time <= 0.0 ? 0 : (uint64_t)(time * TIMESCALE + 0.5);
+  struct tracerec r;
+  size_t pos;
+  int lo = 0, hi = tf->nblocks - 1, mid, b;
+  uint64_t prevtime;
+  int prevseq[2], prevack[2];
+
+  /* the last block starting at or before time: events at time may
+     begin in the block before one that starts at it */
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (tf->index[mid].first < t)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  if (!loadblock(tf, lo))
+    return;
+  /* then read up to the first record at or after it */
+  for (;;) {
+    b = tf->block;
+    pos = tf->pos;
+    prevtime = tf->prevtime;
+    memcpy(prevseq, tf->prevseq, sizeof(prevseq));
+    memcpy(prevack, tf->prevack, sizeof(prevack));
+    if (!trace_next(tf, &r))
+      return;
+    if ((uint64_t)(r.time * TIMESCALE + 0.5) >= t)
+      break;
+  }
+  /* and step back onto it */
+  if (tf->block != b && !loadblock(tf, b))
+    return;
+  tf->pos = pos;
+  tf->prevtime = prevtime;
+  memcpy(tf->prevseq, prevseq, sizeof(prevseq));
+  memcpy(tf->prevack, prevack, sizeof(prevack));
+}
+
+#ifdef TRACE_TOOL
+/* trace tool:  cc -O2 -DTRACE_TOOL -o tracetool trace.c
+
+     tracetool FILE                summary, from the index alone
+     tracetool FILE FROM [TO]      the events from time FROM up to TO
+
+   Only the blocks holding the window are decompressed. */
+
+int main(int argc, char **argv)
+{
+  struct tracefile tf;
+  struct tracerec r;
+  double from, to;
+  long nrecs = 0, n = 0;
+  int i;
+
+  if (argc < 2 || argc > 4) {
+    printf("usage: tracetool FILE [FROM [TO]]\n");
+    return 2;
+  }
+  if (trace_open(&tf, argv[1]) < 0)
+    return 1;
+  if (argc == 2) {
+    for (i = 0; i < tf.nblocks; i++)
+      nrecs += tf.index[i].nrecs;
+    printf("%ld events in %d blocks, %lu bytes, %.2f bytes per event%s\n", nrecs, tf.nblocks,
+           (unsigned long)tf.size, nrecs > 0 ? (double)tf.size / nrecs : 0.0,
+           tf.ownindex ? " (unfinished, index rebuilt)" : "");
+    if (tf.nblocks > 0)
+      printf("time %.6f to %.6f\n", tf.index[0].first / TIMESCALE, tf.index[tf.nblocks - 1].last / TIMESCALE);
+    for (i = 0; i < tf.ntypes; i++)
+      printf("type %d: %s\n", i, tf.names[i]);
+    trace_unmap(&tf);
+    return 0;
+  }
+
+  from = atof(argv[2]);
+  to = argc > 3 ? atof(argv[3]) : 1e300;
+  trace_seek(&tf, from);
+  while (trace_next(&tf, &r) && r.time < to) {
+    printf("%14.6f %c ", r.time, r.entity ? 'B' : 'A');
+    if (r.type < tf.ntypes)
+      printf("%-16s", tf.names[r.type]);
+    else
+      printf("type %-11d", r.type);
+    if (r.haspkt)
+      printf(" seq %d ack %d", r.seq, r.ack);
+    printf("\n");
+    n++;
+  }
+  fprintf(stderr, "%ld events, %d of %d blocks decompressed\n", n, tf.decoded, tf.nblocks);
+  trace_unmap(&tf);
+  return 0;
+}
+#endif
@@ -0,0 +1,102 @@
+/* ******************************************************************
+   Compressed, time indexed event traces.
+
+   A trace holds one record per simulator event: its time, type and
+   entity and, for packets, their sequence and ACK numbers.  Records are
+   a few bytes each: times are kept in millionths of a time unit and
+   written as the difference from the record before, sequence and ACK
+   numbers as the (zigzag) difference from the previous packet at the
+   same entity, all as varints.  They are grouped into blocks of up to
+   TRACE_BLOCKRAW bytes, each compressed on its own (a byte oriented
+   LZ77) and starting afresh, so any block decodes without the ones
+   before it:
+
+      header   "ETRACE1\n"
+      block    record count, raw and compressed length, first time,
+               then the compressed records
+      block    ...
+      index    per block its first and last time and its offset
+      names    the event type names
+      trailer  where the index is, block and type counts, "ETINDEX\n"
+
+   Readers find the block holding a given time by binary search of the
+   index and decompress from there on only as far as they read, so a
+   window of a long run costs a block or two, not the whole file.  The
+   index and names are written when the trace is finished; if the writer
+   never got that far, readers rebuild the index from the block headers
+   (and show types by number).  Blocks are padded to 8 bytes, so headers
+   and index are read in place.  Values are in the host's byte order.
+**********************************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_BLOCKRAW  65536
+#define TRACE_MAXTYPES  32
+#define TRACE_NAMELEN   24
+
+/* an event record */
+struct tracerec {
+  double time;
+  int type;                  /* event type number */
+  int entity;                /* A or B */
+  int haspkt;                /* seq and ack are set */
+  int seq;
+  int ack;
+};
+
+/********* writing ************/
+
+struct tracewriter;
+
+/* start a trace in file, replacing it; NULL (with a message) if it
+   cannot be written */
+extern struct tracewriter *trace_create(const char *file);
+
+/* add a record; times must not go backwards (later ones are taken as
+   equal to the last) */
+extern void trace_add(struct tracewriter *, const struct tracerec *);
+
+/* write out the last block, the index and the type names and close the
+   trace; returns the file size, or -1 on a write error */
+extern long trace_finish(struct tracewriter *, const char *const *names, int ntypes);
+
+/********* reading ************/
+
+struct traceindex {
+  uint64_t first, last;      /* times of the block's first and last records */
+  uint64_t offset;           /* of the block in the file */
+  uint32_t nrecs;
+  uint32_t pad;
+};
+
+struct tracefile {
+  const unsigned char *base; /* the mapping */
+  size_t size;
+  struct traceindex *index;
+  int nblocks;
+  int ownindex;              /* index was rebuilt, and allocated */
+  char names[TRACE_MAXTYPES][TRACE_NAMELEN];
+  int ntypes;                /* 0 if the names are missing */
+  int decoded;               /* blocks decompressed so far */
+  /* read position */
+  int block;                 /* block in buf, -1 if none */
+  unsigned char *buf;
+  size_t len, pos;
+  uint64_t prevtime;
+  int prevseq[2], prevack[2];
+};
+
+/* map a trace for reading; returns -1 (with a message) if it is not one */
+extern int trace_open(struct tracefile *, const char *file);
+extern void trace_unmap(struct tracefile *);
+
+/* move to the first record at or after time */
+extern void trace_seek(struct tracefile *, double time);
+
+/* the next record; returns 0 at the end of the trace */
+extern int trace_next(struct tracefile *, struct tracerec *);
+
+#endif
@@ -0,0 +1,89 @@
+/* ******************************************************************
+   Portable wire format for transport packets.
+
+   struct pkt is laid out the way the host compiler likes it, which is
+   fine inside the emulator but useless between machines.  This is the
+   format used when packets go over a real network: all fields are in
+   network byte order and the layout does not depend on the compiler.
+
+      0       1       2       3
+   +-------+-------+-------+-------+
+   |  ver  | flags |    length     |   length: payload bytes
+   +-------+-------+-------+-------+
+   |            seqnum             |
+   +-------+-------+-------+-------+
+   |            acknum             |
+   +-------+-------+-------+-------+
+   |   checksum    | nsack |  (0)  |   nsack: number of SACK blocks
+   +-------+-------+-------+-------+
+   |     window (if WIRE_WND)      |
+   +-------+-------+-------+-------+
+   |  SACK blocks: start, end (if  |   nsack pairs of 32 bit numbers,
+   |  WIRE_SACK), 8 bytes each     |   each [start,end)
+   +-------+-------+-------+-------+
+   |            payload            |
+   +-------+-------+-------+-------+
+
+   The checksum is the 16 bit ones' complement sum of the whole packet
+   (header, options and payload) with the checksum field taken as 0.
+
+   Decoding does not copy: it checks the packet where it lies in the
+   receive buffer and returns a view whose payload and SACK pointers
+   point into that buffer.  Encoding does not copy either: the caller
+   asks for the header length, puts the payload straight into the send
+   buffer after it, then seals the packet, which writes the header and
+   checksum in front of the payload.
+**********************************************************************/
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIRE_VERSION  1
+#define WIRE_HDRLEN   16   /* fixed part of the header */
+#define WIRE_MAXSACK  4    /* most SACK blocks one packet can carry */
+
+/* flags */
+#define WIRE_DATA  0x01    /* seqnum and payload are valid */
+#define WIRE_ACK   0x02    /* acknum is valid */
+#define WIRE_WND   0x04    /* window field is present */
+#define WIRE_SACK  0x08    /* SACK blocks are present */
+#define WIRE_FIN   0x10    /* last packet of the stream */
+
+/* a decoded header.  For a received packet, payload and sack point into
+   the receive buffer and are only valid as long as it is. */
+struct wirehdr {
+  uint8_t flags;
+  uint16_t length;                /* payload bytes */
+  uint32_t seqnum;
+  uint32_t acknum;
+  uint32_t window;                /* receive window, if WIRE_WND */
+  int nsack;                      /* SACK blocks, if WIRE_SACK */
+  uint32_t sack[WIRE_MAXSACK][2]; /* [start,end) of each block, for encoding */
+  const unsigned char *sackptr;   /* SACK blocks in the receive buffer, after decoding */
+  const unsigned char *payload;   /* payload in the receive buffer, after decoding */
+};
+
+/* bytes of header (fixed part and options) a packet with header h needs;
+   the payload goes this far into the send buffer */
+extern size_t wire_hdrlen(const struct wirehdr *h);
+
+/* write header h in front of the h->length payload bytes already placed at
+   buf + wire_hdrlen(h), and checksum the packet.  Returns the total packet
+   length, or 0 if it does not fit in buflen bytes. */
+extern size_t wire_seal(unsigned char *buf, size_t buflen, const struct wirehdr *h);
+
+/* copy payload into buf and seal it; for callers that do not build the
+   payload in place */
+extern size_t wire_encode(unsigned char *buf, size_t buflen, const struct wirehdr *h,
+                          const void *payload);
+
+/* check the len byte packet at buf and fill in h.  Returns 0, or -1 if the
+   packet is truncated, of the wrong version or fails its checksum. */
+extern int wire_decode(const unsigned char *buf, size_t len, struct wirehdr *h);
+
+/* SACK block i of a decoded header */
+extern void wire_getsack(const struct wirehdr *h, int i, uint32_t *start, uint32_t *end);
+
+#endif